@@ -0,0 +1,96 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	Clock.c
+* \details  This module selects the system clock.  The normal build runs from the
+*			4MHz internal oscillator.  When \em CLOCK_32MHZ is defined the 8MHz
+*			internal oscillator runs through the x4 PLL for 32MHz and the PLL is
+*			turned off for an 8MHz idle clock whenever there is no serial traffic
+*			and no upload or EEPROM scan has asked for a boost.  The idle clock
+*			is exactly one timer prescale step slower so the PWM timers and the
+*			UART are rescaled to keep their rates and the clock is only changed
+*			between characters.  The delay routines are calibrated for the full
+*			clock so delays run long at the idle clock.
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include "Clock.h"
+
+#ifdef CLOCK_32MHZ
+#include "PWM.h"
+#include "RS485.h"
+#include "SBUS.h"
+
+#define QUIETTICKS	(100)				// quiet ticks before dropping to the idle clock (0.5S)
+
+static unsigned char boosts;			// nested Clock_Boost() calls
+static unsigned char quiet;				// ticks without traffic or a boost
+static BOOL full;						// TRUE at the full clock
+
+static void SetClock (BOOL fast) {
+	// Change clocks between characters and rescale the timers to match.  The
+	// timers are rescaled first when speeding up so they run slow rather than
+	// fast while the PLL locks and the UART is reloaded once the clock changes.
+	if ((fast == full) || !RS485_Idle()) return;
+	di();
+	if (fast) {
+		PWM_SetClock(TRUE);
+		OSCCONbits.SPLLEN = 1;			// x4 PLL enabled
+		while (!OSCSTATbits.PLLR)		// wait for the PLL to lock (2mS max)
+			continue;
+	} else {
+		OSCCONbits.SPLLEN = 0;			// x4 PLL disabled
+		PWM_SetClock(FALSE);
+	}
+	RS485_SetClock(fast);
+	ei();
+	full = fast;
+}
+#endif
+
+void Clock_Init (void) {
+#ifdef CLOCK_32MHZ
+	// Select the internal 8MHz oscillator with the x4 PLL
+	OSCCONbits.IRCF = 0b1110;		// 8MHz clock select
+	OSCCONbits.SCS = 0b00;			// Clock from FOSC (INTOSC) -- needed for the PLL
+	OSCCONbits.SPLLEN = 1;			// x4 PLL enabled
+	while (!OSCSTATbits.PLLR)		// wait for the PLL to lock
+		continue;
+	full = TRUE;
+	boosts = 0; quiet = 0;
+#else
+	// Select the internal 4MHz oscillator
+	OSCCONbits.IRCF = 0b1101;		// 4MHz clock select
+	OSCCONbits.SCS = 0b11;			// Internal oscillator
+	OSCCONbits.SPLLEN = 0;			// x4 PLL disabled
+#endif
+}
+
+#ifdef CLOCK_32MHZ
+void Clock_Boost (void) {
+	boosts++;
+	quiet = 0;
+	SetClock(TRUE);
+}
+
+void Clock_Release (void) {
+	if (boosts > 0) boosts--;
+}
+
+void Clock_Task (void) {
+	if ((boosts > 0) || !SBUS_Idle()) {
+		quiet = 0;
+		SetClock(TRUE);
+	} else if (quiet < QUIETTICKS) {
+		quiet++;
+	} else {
+		SetClock(FALSE);
+	}
+}
+#endif
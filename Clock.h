@@ -0,0 +1,24 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include "Types.h"
+
+extern void Clock_Init (void);
+// Selects the internal oscillator at _XTAL_FREQ.
+
+#ifdef CLOCK_32MHZ
+extern void Clock_Boost (void);
+// Runs at the full clock until the matching Clock_Release().  Boosts nest.
+
+extern void Clock_Release (void);
+// Ends a Clock_Boost().  The clock drops later once the controller is idle.
+
+extern void Clock_Task (void);
+// Scheduled every tick -- stays at the full clock while there is serial
+// traffic or a boost and drops to the idle clock once things are quiet.
+#else
+#define Clock_Boost()
+#define Clock_Release()
+#endif
+
+#endif
@@ -8,13 +8,23 @@
 /**
 * \file   	EEPROM.c
 * \details  This module implements the interface to the Microchip 24LC256 EEPROM.
-*			Code in comments was the original (unsuccessful) attempt to use the I2C
-*			hardware port.  I eventually resorted to using a bit-banged I2C software
-*			implementation (see \em I2C.c) due to the problems I was having.  
+*			The I2C bus transfers are done by the \em I2C.c module which uses 
+*			either a bit-banged software bus or the MSSP1 hardware port.
 *
-*			If anyone can get the hardware I2C working, please send me the code.  To
-*			simplify maintenance, I suggest putting the hardware I2C code in the
-*			I2C.c module in place of the existing software I2C.
+*			Writes return as soon as the data has been sent.  The EEPROM's
+*			internal write cycle is detected by acknowledge polling before the
+*			next transfer so callers can do other work while the EEPROM is busy.
+*
+*			Sequential scans use a read stream which keeps a single I2C read
+*			open so each byte costs only its own nine clocks.  No other EEPROM
+*			access is allowed between EEPROM_OpenRead() and EEPROM_CloseRead().
+*
+*			Writes go through a one-page write-back cache.  Writes to the same
+*			64-byte page are merged and bytes that don't change are skipped.  The
+*			page is written when a different page is written, a stream is opened,
+*			or EEPROM_Flush() is called.  Reads see the cached data.  Whole page
+*			writes are compared too (see COMPARE_PAGES) so rewriting identical
+*			data costs only the reads.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -24,123 +34,135 @@
 #include "EEPROM.h"
 #include "I2C.h"
 
-//#define EEPROM_DEVICE	(0xA0)		// Base device address for EEPROM
 #define PAGE_SIZE		(64)		// Write page size for Microchip's 24xx256 EEPROM
 #define EEPROM_BYTES	(1024*32)	// 32KB EEPROM
-
-// Register bit definitions
-//#define SEN		SSP1CON2bits.SEN
-//#define RSEN	SSP1CON2bits.RSEN
-//#define RCEN	SSP1CON2bits.RCEN
-//#define PEN		SSP1CON2bits.PEN
-//#define ACKEN	SSP1CON2bits.ACKEN
-//#define ACKDT	SSP1CON2bits.ACKDT
-//#define ACKSTAT	SSP1CON2bits.ACKSTAT
-//#define BF		SSP1STATbits.BF
+#define MAXPOLLS		(200)		// acknowledge polls before giving up on a write cycle
+
+// Define COMPARE_PAGES to read and compare whole page writes as well as partial ones
+// so a page whose contents don't change is never written.  Comment it out to write
+// whole pages without reading them first (faster for a fresh EEPROM).
+#define COMPARE_PAGES
+
+static BOOL writePending;			// TRUE while the EEPROM may still be writing
+static unsigned int writeCount;		// write cycles started
+static unsigned int pollCount;		// total acknowledge polls while writing
+static unsigned int pollMax;		// most polls for one write cycle
+
+static unsigned char cache[PAGE_SIZE];	// write-back copy of one EEPROM page
+static unsigned int cachePage;		// address of the cached page
+static BOOL cacheValid;				// TRUE if cache[] holds the page at cachePage
+static unsigned char dirtyLo;		// first changed byte in cache[]
+static unsigned char dirtyHi;		// last changed byte in cache[] -- clean if dirtyLo > dirtyHi
+static unsigned int cacheHits;		// writes merged into the cached page
+static unsigned int cacheFlushes;	// cached pages written to EEPROM
 
 void EEPROM_Init (void) {
  	// Set up the I2C registers
-//	TRISBbits.TRISB4 = 1;			// Set I2C pins as inputs
-//	TRISBbits.TRISB6 = 1;
-//	SSP1CON = 0x38;					// Set I2C master mode
-//	SSP1CON2 = 0x00;
-//	SSP1ADD = 10;					// Baud rate initialization for 100KHz
-//	SSP2STATbits.CKE = 1;
-//	SSP2STATbits.SMP = 1;
-//	
-//	SSP1IF = 0;						// clear SSPIF interrupt flag
-//	BCL1IF = 0;						// clear bus collision flag	
-	
-//  	SSP1STAT &= 0x3F;           // power on state 
-//  	SSP1CON = 0x00;            	// power on state
-//  	SSP1CON2 = 0x00;            // power on state
-//  	SSP1CON |= 0b00001000;   	// select serial mode (Master)
-//  	SSP1STAT |= 0b10000000;    	// slew rate off 
-//	SSP1ADD = 10;				// Baud rate initialization for 100KHz
-//
-//  	TRISBbits.TRISB4 = 1;       // Set I2C pins as inputs
-//  	TRISBbits.TRISB6 = 1;       // 
 	I2C_BEGIN();
+	writePending = FALSE;
+	writeCount = 0; pollCount = 0; pollMax = 0;
+	cacheValid = FALSE; dirtyLo = PAGE_SIZE; dirtyHi = 0;
+	cacheHits = 0; cacheFlushes = 0;
+}
 
-//  	SSP1CON1 |= SSPENB;        // enable synchronous serial port 
+static void WaitForWrite (void) {
+	/////////////////////////////////////////////////////////////////////////	
+	// Wait for the last write cycle to finish by polling for an acknowledge
+	unsigned int polls = 0;
+	
+	if (writePending) {
+		while (!I2C_Poll() && (polls < MAXPOLLS)) polls++;
+		pollCount += polls;
+		if (polls > pollMax) pollMax = polls;
+		writePending = FALSE;
+	}	
 }
 
-//#define Wait()  SSP1IF = 0;	while (SSP1IF == 0);	// Wait for start to complete
+static void StartWrite (void) {
+	// The EEPROM has started an internal write cycle
+	writePending = TRUE;
+	writeCount++;
+}
 
-//static void Wait (void) {
-//  	while ( ( SSP1CON2 & 0x1F ) | ( SSP1STATbits.R_nW ) )
-//     	continue;
-//}		
+BOOL EEPROM_Busy (void) {
+	// Returns TRUE iff the EEPROM is still busy with a write cycle
+	if (writePending && I2C_Poll()) writePending = FALSE;
+	return writePending;
+}
 
-//static void SendStart (void) {
-//	Wait();
-//	SEN = 1;						// Generate a start condition
-//}
-//
-//static void SendRestart (void) {
-//	Wait();
-//	RSEN = 1;						// Generate a restart condition
-//}
-//
-//static void SendStop (void) {
-//	Wait();
-//	PEN = 1;						// Generate a stop condition
-//}	
-
-//static unsigned char SendByte (unsigned char b) {
-////	Wait();
-////	SSP1BUF = b;					// Send out a byte
-////	return (!ACKSTAT);				// Returns '1' if transmission was acknowledged
-//	return I2C_Send(b);
-//}
-//
-//static unsigned char ReadByte (unsigned char ack) {
-////	unsigned char i2cdata;
-////	
-////	Wait();
-////	RCEN = 1;						// Clock in a data byte
-////	Wait();
-////	i2cdata = SSP1BUF;				// Get the data locally	
-////	Wait();
-////	if (ack) ACKDT = 0;
-////	else ACKDT = 1;
-////	ACKEN = 1;
-////	return i2cdata;
-//}
-
-//static void SendAddress (unsigned int add) {
-//	SendStart();					// Start the write with a start condition
-//	SendByte(EEPROM_DEVICE);		// Send out the device address
-//	SendByte(add >> 8);				// Send out the high memory address byte
-//	SendByte(add);					// Send out the low memory address byte
-//}			
+void EEPROM_GetStats (unsigned int *writes, unsigned int *polls, unsigned int *maxPolls) {
+	// Returns the write cycle count, total and maximum acknowledge polls while waiting
+	*writes = writeCount;
+	*polls = pollCount;
+	*maxPolls = pollMax;
+}
+
+void EEPROM_GetCacheStats (unsigned int *hits, unsigned int *flushes) {
+	// Returns the number of writes merged into the cached page and pages written
+	*hits = cacheHits;
+	*flushes = cacheFlushes;
+}
+
+void EEPROM_Flush (void) {
+	// Writes the changed part of the cached page to EEPROM
+	if (cacheValid && (dirtyLo <= dirtyHi)) {
+		WaitForWrite();
+		I2C_SendBuf(cachePage+dirtyLo, &cache[dirtyLo], dirtyHi-dirtyLo+1);
+		StartWrite();
+		cacheFlushes++;
+		dirtyLo = PAGE_SIZE; dirtyHi = 0;
+	}	
+}
+
+static void CacheWrite (unsigned int add, unsigned char buffer[], unsigned char size) {
+	// Merges 'size' bytes into the cache.  All bytes must lie in the same page.
+	unsigned char offset = add & (PAGE_SIZE-1);
+	unsigned char i;
+	BOOL fill;
+	
+	add -= offset;
+	if (cacheValid && (add == cachePage)) {
+		cacheHits++;
+		fill = FALSE;
+	} else {	
+		// switch pages -- read the old contents so unchanged bytes aren't written
+		EEPROM_Flush();
+		cachePage = add; cacheValid = TRUE;
+#ifdef COMPARE_PAGES
+		fill = FALSE;
+#else
+		fill = (size == PAGE_SIZE);
+#endif
+		if (!fill) {
+			WaitForWrite();
+			I2C_GetBuf(add, cache, PAGE_SIZE);
+		}	
+	}
+	for (i=0; i<size; i++, offset++) {
+		if (fill || (cache[offset] != buffer[i])) {
+			cache[offset] = buffer[i];
+			if (offset < dirtyLo) dirtyLo = offset;
+			if (offset > dirtyHi) dirtyHi = offset;
+		}
+	}		
+}
+
+static void CacheRead (unsigned int add, unsigned char buffer[], unsigned int size) {
+	// Replaces any bytes read from EEPROM that have changed in the cache
+	unsigned int first, last;
+	
+	if (dirtyLo > dirtyHi) return;			// EEPROM is up to date
+	first = cachePage+dirtyLo; last = cachePage+dirtyHi;
+	if (add > first) first = add;
+	if (add+size-1 < last) last = add+size-1;
+	for (; first<=last; first++) buffer[first-add] = cache[first-cachePage];
+}
 
 void EEPROM_WriteChar(unsigned int add, unsigned char ch) {
 	/////////////////////////////////////////////////////////////////////////	
 	// Send a data byte
-	I2C_Send(add, ch);
-   __delay_ms(6);					/* write time delay */	
-//	
-//	SendAddress(add);				// Send the device & memory address
-//	SendByte(ch);					// Send the data byte to be written
-//	SendStop();						// Indicate no more data to write
-//	__delay_ms(11);					// delay unil write is done
-	
+	CacheWrite(add, &ch, 1);
 }
-
-//static void WritePage (unsigned int add, unsigned char buffer[], unsigned int size) {
-//	/////////////////////////////////////////////////////////////////////////	
-//	// Send a page (64 bytes) of data to EEPROM.  The caller must guarantee
-//	// that only page writes will occur.
-//	unsigned int i;
-//	
-//	SendAddress(add);				// Send the device & memory address
-//	for (i=0; i<size; i++) {
-//		SendByte(buffer[i]);		// Send the data bytes to be written
-//	}
-//	SendStop();						// Indicate no more data to write
-//	__delay_ms(11);					// delay unil write is done
-//}	
 	
 void EEPROM_Write(unsigned int add, unsigned char buffer[], unsigned int size) {
 	/////////////////////////////////////////////////////////////////////////	
@@ -154,18 +176,14 @@ void EEPROM_Write(unsigned int add, unsigned char buffer[], unsigned int size) {
 		// starting in the middle of an EEPROM page -- write partial page first
 		lsize = PAGE_SIZE - lsize;
 		if (lsize > size) lsize = size;
-		I2C_SendBuf(add, buffer, lsize);
-   		__delay_ms(6);					/* write time delay */	
-//		WritePage(add, buffer, lsize);
+		CacheWrite(add, buffer, lsize);
 		size -= lsize;
 		add += lsize; 
 	}
 	
 	// Write all the PAGE_SIZEd segments to EEPROM
 	while (size >= PAGE_SIZE) {
-//		WritePage(add, &buffer[lsize], PAGE_SIZE);
-		I2C_SendBuf(add, &buffer[lsize], PAGE_SIZE);
-   		__delay_ms(6);					/* write time delay */	
+		CacheWrite(add, &buffer[lsize], PAGE_SIZE);
 		size -= PAGE_SIZE;
 		add += PAGE_SIZE;
 		lsize += PAGE_SIZE; 		
@@ -173,18 +191,12 @@ void EEPROM_Write(unsigned int add, unsigned char buffer[], unsigned int size) {
 	
 	// Write any remnant bytes
 	if (size > 0) {
-		I2C_SendBuf(add, &buffer[lsize], size);
-   		__delay_ms(6);					/* write time delay */	
+		CacheWrite(add, &buffer[lsize], size);
 	}	
 }
 
 BOOL EEPROM_Present (void) {
-//	unsigned char ack;
-//	
-//	SendStart();					// Start command sequence
-//	ack = SendByte(EEPROM_DEVICE);	// Send out the device address
-//	SendStop();
-//	if (ack == 0) return FALSE;		// No acknowledge from slave
+	WaitForWrite();
 	return I2C_Device_Present();	
 }
 
@@ -192,33 +204,42 @@ unsigned int EEPROM_GetSize (void) {
 	return EEPROM_BYTES;	
 }	
 
+void EEPROM_OpenRead(unsigned int add) {
+	// Starts a sequential read stream at 'add'
+	EEPROM_Flush();
+	WaitForWrite();
+	I2C_OpenRead(add);
+}
+
+unsigned char EEPROM_ReadNext(void) {
+	// Returns the next byte of the read stream
+	return I2C_ReadNext();
+}
+
+void EEPROM_ReadBlock(unsigned char buffer[], unsigned int size) {
+	// Reads the next 'size' bytes of the read stream
+	unsigned int i;
+	
+	for (i=0; i<size; i++) buffer[i] = I2C_ReadNext();
+}
+
+void EEPROM_CloseRead(void) {
+	// Ends the read stream
+	I2C_CloseRead();
+}
+
 unsigned char EEPROM_ReadChar(unsigned int add) {
-//	unsigned char data;
-//	
-//	///////////////////////////////////////////////////////////////////////////////
-//	// Read a byte
-//	SendAddress(add);				// Send the device & memory address		
-//	SendRestart();					// Prepare to read
-//	SendByte(EEPROM_DEVICE+1);		// Send out the device read address byte
-//	data = ReadByte(0);				// Read back the data
-//	SendStop();						// Close down the read session
-//	return data;
-	return I2C_Get(add);
+	unsigned char ch;
+	
+	WaitForWrite();
+	ch = I2C_Get(add);
+	CacheRead(add, &ch, 1);
+	return ch;
 }
 	
 void EEPROM_Read(unsigned int add, unsigned char buffer[], unsigned int size) {
-//	unsigned int i;
-//	
-//	///////////////////////////////////////////////////////////////////////////////
-//	// Read a block of bytes from EEPROM
-//	SendAddress(add);				// Send the device & memory address		
-//	SendRestart();					// Prepare to read
-//	SendByte(EEPROM_DEVICE+1);		// Send out the device read address byte
-//	for (i=0; i<size; i++) {
-//		buffer[i] = ReadByte((i != size-1));	// Read back the data
-//	}
-//	SendStop();						// Close down the read session
+	WaitForWrite();
 	I2C_GetBuf(add, buffer, size);
+	CacheRead(add, buffer, size);
 }	
 
-
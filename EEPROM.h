@@ -6,6 +6,14 @@
 extern void EEPROM_Init (void);
 extern BOOL EEPROM_Present (void);
 extern unsigned int EEPROM_GetSize (void);
+extern BOOL EEPROM_Busy (void);
+extern void EEPROM_Flush (void);
+extern void EEPROM_GetCacheStats (unsigned int *hits, unsigned int *flushes);
+extern void EEPROM_OpenRead (unsigned int add);
+extern unsigned char EEPROM_ReadNext (void);
+extern void EEPROM_ReadBlock (unsigned char buffer[], unsigned int size);
+extern void EEPROM_CloseRead (void);
+extern void EEPROM_GetStats (unsigned int *writes, unsigned int *polls, unsigned int *maxPolls);
 
 extern void EEPROM_WriteChar(unsigned int add, unsigned char ch);
 extern void EEPROM_Write(unsigned int add, unsigned char buffer[], unsigned int size);
@@ -6,11 +6,11 @@
 //************************************************************************************
 /**
 * \file   	I2C.c
-* \details  This module implements a software-based I2C bus protocol.  I used a
-*			software I2C implementation even though this device has a hardware I2C
-*			port because there were some issues in getting the hardware port to work
-*			with the Microchip EEPROM.  If anyone else can get the hardware port
-*			to work, please send me the code.
+* \details  This module implements the I2C bus protocol.  By default a software
+*			(bit-banged) I2C implementation is used.  If \em I2C_HARDWARE is 
+*			defined in I2C.h, the MSSP1 hardware port is used instead at the
+*			\em I2C_SPEED bus clock.  Both versions provide the same bus 
+*			primitives so the transfer functions at the end are shared.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -19,6 +19,119 @@
 #include "I2C.h"
 #include "Types.h"
 
+#define I2C_device	0xA0		// Base device address for EEPROM
+
+void I2C_Power(BOOLEAN TurnOn, BOOLEAN Count)
+{	
+}
+
+#ifdef I2C_HARDWARE
+
+#define SCLDIR TRISBbits.TRISB6		/* SCL1 on B6 */
+#define SDADIR TRISBbits.TRISB4 	/* SDA1 on B4 */
+#define IN	   1
+
+/* Baud rate generator reload rounded to the next slower clock -- 3 is the minimum */
+#define I2C_BRGCALC	((_XTAL_FREQ + 4UL*I2C_SPEED - 1) / (4UL*I2C_SPEED) - 1)
+#if I2C_BRGCALC < 3
+#define I2C_BRG		3
+#else
+#define I2C_BRG		I2C_BRGCALC
+#endif
+#if I2C_BRG > 255
+#error "I2C_SPEED is too slow for this clock"
+#endif
+
+static void Wait(void)
+{
+   /* wait for any start, restart, stop, receive, acknowledge, or transmit to finish */
+   while ((SSP1CON2 & 0x1F) || SSP1STATbits.R_nW)
+      continue;
+} /* end Wait() */
+
+
+static BOOLEAN SendByteAck(TCHAR b)
+{
+   Wait();
+   PIR1bits.SSP1IF = 0;
+   SSP1BUF = b;				/* send out the byte */
+   while (!PIR1bits.SSP1IF)	/* wait for the acknowledge clock */
+      continue;
+   return (SSP1CON2bits.ACKSTAT == 0);
+} /* end SendByteAck() */
+
+
+static TCHAR Receive(BOOLEAN ack)
+{
+   TCHAR lb;
+   
+   Wait();
+   PIR1bits.SSP1IF = 0;
+   SSP1CON2bits.RCEN = 1;		/* clock in a data byte */
+   while (!PIR1bits.SSP1IF)
+      continue;
+   lb = SSP1BUF;
+   SSP1CON2bits.ACKDT = !ack;	/* acknowledge all but the last byte */
+   SSP1CON2bits.ACKEN = 1;
+   return lb;
+} /* end Receive() */
+
+
+static TCHAR ReceiveByte(void)
+{
+   return Receive(FALSE);
+} /* end ReceiveByte() */
+
+
+static TCHAR ReceiveByteAck(void)
+{
+   return Receive(TRUE);
+} /* end ReceiveByteAck() */
+
+
+static void DoStart(void)
+{
+   Wait();
+   SSP1CON2bits.SEN = 1;		/* generate a start condition */
+} /* end DoStart() */
+
+
+static void DoRestart(void)
+{
+   Wait();
+   SSP1CON2bits.RSEN = 1;		/* generate a repeated start condition */
+} /* end DoRestart() */
+
+
+static void Stop(void)
+{
+   Wait();
+   SSP1CON2bits.PEN = 1;		/* generate a stop condition */
+   Wait();
+} /* end Stop() */
+
+
+static void I2C_Init(void)
+{
+   /* set up the MSSP1 port as an I2C master */
+   SDADIR = IN;				/* MSSP drives SCL, SDA */
+   SCLDIR = IN;
+   SSP1CON1 = 0x28;			/* SSPEN, I2C master mode with BRG clock */
+   SSP1CON2 = 0x00;
+   SSP1CON3 = 0x00;
+   SSP1ADD = I2C_BRG;
+#if I2C_SPEED > 100000UL
+   SSP1STAT = 0x00;			/* slew rate control on for fast mode */
+#else
+   SSP1STAT = 0x80;			/* slew rate control off for standard mode */
+#endif
+   PIR1bits.SSP1IF = 0;
+   PIR2bits.BCL1IF = 0;
+   I2C_Power(FALSE, FALSE);	/* initially turn off I2C power */	
+}
+
+#else
+
 #define SCLDIR TRISBbits.TRISB6		/* Clock on B6 */
 #define SDADIR TRISBbits.TRISB4 	/* Data on B4 */
 #define SDAIN  PORTBbits.RB4
@@ -27,15 +140,23 @@
 #define IN	   1
 #define OUT    0
 
-#define I2C_device	0xA0		// Base device address for EEPROM
+/* The SCL high and low times are set by the instruction time at 4MHz -- pad them 
+   at faster clocks to keep within the 400kHz bus timing */
+#if _XTAL_FREQ > 4000000
+#define BITDELAY()	__delay_us(1)
+#else
+#define BITDELAY()
+#endif
 
 static BOOLEAN Ack(void)
 { 
    BOOLEAN ack;
 	
+   BITDELAY();
    SCLDIR = IN;   			/* set SCL as an input so SCL goes high */
    
    /* assume SDA is input */
+   BITDELAY();
    ack = (SDAIN == 0);		/* sample SDA acknowledge */
    if (ack) ;				/* delay clock */				
    SCLDIR = OUT; 			/* set SCL to an output so SCL goes low */
@@ -50,8 +171,10 @@ static void SendByte(TCHAR b)
    while (cnt--) {  
       if (b&0x80) SDADIR = IN;  /* set SDA as input -> goes high */
       else SDADIR = OUT;		/* set SDA as output -> goes low */
+      BITDELAY();
       SCLDIR = IN;		 		/* set SCL as input -> goes high */
       b <<= 1; 		 	 		/* shift left 1 bit (part of delay) */			 
+      BITDELAY();
       SCLDIR = OUT;	 	 		/* set SCL as output -> goes low */    
    } /* end while */
    cnt = 0;						/* delay for data hold */
@@ -73,7 +196,9 @@ static TCHAR ReceiveByte(void)
 	
    while (cnt--) {
       lb<<=1;			 	/* shift left 1 bit position */   	
+      BITDELAY();
       SCLDIR = IN;		 	/* set SCL as input -> goes high */   	  
+      BITDELAY();
       if (SDAIN) lb|=1;  	/* set LSB of byte */
       SCLDIR = OUT;			/* set SCL as output -> goes low */    
    } /* end while */  
@@ -103,20 +228,10 @@ static void DoStart(void)
 } /* end DoStart() */
 
 
-void I2C_Power(BOOLEAN TurnOn, BOOLEAN Count)
-{	
-}
-
-static void Start(TCHAR b, LONGINT adr)
+static void DoRestart(void)
 {
-   I2C_Power(TRUE, FALSE);			/* Power on memories */
-   DoStart(); 
-
-   /* start sending the data */
-   SendByteAck(b);
-   SendByteAck((TCHAR)(adr>>8));	/* output remainder of address */
-   SendByteAck((TCHAR)(adr));  
-} /* end Start() */
+   DoStart();
+} /* end DoRestart() */
 
 
 static void Stop(void)
@@ -127,7 +242,7 @@ static void Stop(void)
    SCLDIR = IN;         /* set SCL as input -> goes high */ 
    __delay_us(5);		/* set-up time delay */
    SDADIR = IN;	        /* set SDA as input -> goes high */  
-} /* end Stop() */	
+} /* end Stop() */
 
 static void I2C_Init(void)
 {
@@ -138,7 +253,21 @@ static void I2C_Init(void)
    SCL = 0;
    I2C_Power(FALSE, FALSE);	/* initially turn off I2C power */	
 }
-	
+
+#endif
+
+
+static void Start(TCHAR b, LONGINT adr)
+{
+   I2C_Power(TRUE, FALSE);			/* Power on memories */
+   DoStart(); 
+
+   /* start sending the data */
+   SendByteAck(b);
+   SendByteAck((TCHAR)(adr>>8));	/* output remainder of address */
+   SendByteAck((TCHAR)(adr));  
+} /* end Start() */
+
 
 void I2C_GetBuf(LONGINT adr, TCHAR buf[], CARDINAL size)
 {
@@ -147,7 +276,7 @@ void I2C_GetBuf(LONGINT adr, TCHAR buf[], CARDINAL size)
    Start(I2C_device, adr);			/* output start bit and device address */
    
    /* do start bit again */
-   DoStart();     
+   DoRestart();     
    SendByteAck(I2C_device+1);
    for (ind=0; ind<size-1; ind++) {
       buf[ind] = ReceiveByteAck(); 	/* receive data buffer */
@@ -164,7 +293,7 @@ TCHAR I2C_Get(LONGINT adr)
    Start(I2C_device, adr);		/* output start bit and device address */
    
    /* do start bit */
-   DoStart();     
+   DoRestart();     
    SendByteAck(I2C_device+1);	/* send device address -- read mode */
    ch = ReceiveByte();			/* receive byte */
    Stop();						/* output stop bit */
@@ -172,6 +301,29 @@ TCHAR I2C_Get(LONGINT adr)
 } /* end Get() */
 
 
+void I2C_OpenRead(LONGINT adr)
+{
+   Start(I2C_device, adr);		/* output start bit and device address */
+   
+   /* do start bit again */
+   DoRestart();     
+   SendByteAck(I2C_device+1);	/* send device address -- read mode */
+} /* end OpenRead() */
+
+
+TCHAR I2C_ReadNext(void)
+{
+   return ReceiveByteAck();		/* acknowledge so the device sends the next byte */
+} /* end ReadNext() */
+
+
+void I2C_CloseRead(void)
+{
+   (void)ReceiveByte();			/* NACK ends the device's transfer */
+   Stop();						/* output stop bit */
+} /* end CloseRead() */
+
+
 BOOLEAN I2C_GetAck(void)
 {
    TCHAR ch;
@@ -199,6 +351,17 @@ void I2C_SendBuf(LONGINT adr, TCHAR buf[], CARDINAL size)
 } /* end SendBuf() */
 
 
+BOOLEAN I2C_Poll(void)
+{
+   BOOLEAN ack;
+
+   DoStart();
+   ack = SendByteAck(I2C_device);	/* send device address -- write mode */
+   Stop();
+   return ack;
+} /* end Poll() */
+
+
 BOOLEAN I2C_Device_Present(void)
 {
     // Check for device twice before giving up
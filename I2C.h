@@ -9,6 +9,16 @@
 #define ON  (TRUE)
 #define OFF (FALSE)
 
+// Define I2C_HARDWARE to use the MSSP1 hardware port instead of the software I2C bus
+//#define I2C_HARDWARE
+
+// Hardware I2C bus clock in Hz -- 100000 (standard) or 400000 (fast mode).  The MSSP
+// baud rate generator limits the clock to _XTAL_FREQ/16 so fast mode needs a system
+// clock of at least 6.4MHz.
+#ifndef I2C_SPEED
+#define I2C_SPEED	(100000UL)
+#endif
+
 #define I2C_SetDevice(dev) I2C_device = (TCHAR)dev
 
 /* USART 0 Control */
@@ -63,6 +73,10 @@ extern BOOLEAN I2C_Device_Present(void);
 /* Return TRUE iff the active device (I2C_device) is currently connected to the 
    I2C bus and responding with ACKs; otherwise, return FALSE. */
 
+extern BOOLEAN I2C_Poll(void);
+/* Return TRUE iff the active device acknowledges its write address.  A 24xx EEPROM
+   doesn't acknowledge while an internal write cycle is in progress. */
+
 extern BOOLEAN I2C_Send(LONGINT adr, TCHAR byte);
 /* Transmit a byte 'b'. */
 
@@ -79,6 +93,12 @@ extern void I2C_GetBuf(LONGINT adr, TCHAR * buf, CARDINAL size);
 /* Receive the contents of buffer 'buf'. */
 
 
+extern void I2C_OpenRead(LONGINT adr);
+/* Start a sequential read at address 'adr'.  The bus stays busy until I2C_CloseRead(). */
+extern TCHAR I2C_ReadNext(void);
+/* Receive the next byte of an open sequential read. */
+extern void I2C_CloseRead(void);
+/* End a sequential read. */
 extern void I2C_BEGIN(void);
 
 
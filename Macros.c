@@ -30,9 +30,14 @@ unsigned int ReadWord (unsigned char address) {
 	return word;
 }
 
+void WriteByte (unsigned char address, unsigned char data) {
+	// only write if the byte changes -- saves the write time and wear
+	if (eeprom_read(address) != data) eeprom_write(address, data);
+}
+
 void WriteWord (unsigned char address, unsigned int data) {
-	eeprom_write(address, data >> 8);
-	eeprom_write(address+1, data);
+	WriteByte(address, data >> 8);
+	WriteByte(address+1, data);
 }
 
 unsigned int Macros_Count (void) {
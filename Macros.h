@@ -10,6 +10,9 @@
 extern unsigned int ReadWord (unsigned char address);
 extern void WriteWord (unsigned char address, unsigned int data);
 
+// write a byte to internal EEPROM unless it is unchanged
+extern void WriteByte (unsigned char address, unsigned char data);
+
 extern unsigned int Macros_Count (void);
 
 extern BOOL Macros_Add(unsigned int macro);
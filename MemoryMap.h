@@ -11,8 +11,15 @@
 #define STARTSEQADD		(NIGHTADD+5)			// 2 bytes - First sequence to play on power-up
 #define TOTALSEQADD		(NIGHTADD+7)			// 2 bytes - Number of sequences to play
 #define DEVICEADD		(NIGHTADD+9)			// 1 byte - Protocol address (0xFF is default)
+#define CARRIERADD		(NIGHTADD+13)			// 1 byte - PWM carrier mode (0xFF is default)
+#define DIMMERADD		(NIGHTADD+14)			// 1 byte - Master dimmer (0xFF is full intensity)
+#define TEMPOADD		(NIGHTADD+15)			// 1 byte - Fade/hold tempo in 1/64ths (0xFF is normal)
 #define EESEQADD		(0x10)					// Start of EEPROM macro sequences
 
 #define MAXMACROS		(100)					// Allow up to 100 macros
 
+#define CHDIMMERADD		(0xF0)					// 4 bytes - Channel dimmers (0xFF is full intensity)
+#define XFADEADD		(0xF4)					// 1 byte - Crossfade between sequences as a fade value (0xFF is off)
+#define NAPADD			(0xF5)					// 1 byte - Nap between ticks while dark and idle (1 is on, 0xFF is off)
+
 #endif
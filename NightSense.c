@@ -3,10 +3,6 @@
 #include "MemoryMap.h"
 #include "Macros.h"
 
-#define	PERIOD		4							// Desired clock in Hz - 1/4 Sec
-#define	SCALE		(64*16)						// Timer 6 prescale & postscale
-#define	PRCOUNT		(IPERIOD/SCALE/PERIOD)
-
 // Night sense state definitions
 typedef enum _NightState {	
 	DISABLED, ACTIVE=0x01, NIGHTTIMING, DAYTIMING, ISDARK
@@ -20,7 +16,7 @@ static NightState state;			// night sense state machine
 
 
 void NightSense_UpdateState (void) {
-	// Function called by interrupt every minute
+	// Function called by the scheduler every minute
 	switch (state) {
 		case ACTIVE:
 			if (PORTAbits.RA4 != 0) {
@@ -58,14 +54,6 @@ void NightSense_UpdateState (void) {
 void NightSense_Init (void) {
 	TRISAbits.TRISA4 = 1;			// set to input for optics sensor
 	
-	// Initialize Timer 6 for clock timing
-	PR6 = PRCOUNT-1;				// PWM update period
-	PIR3bits.TMR6IF = 0;			// Clear Timer6 interrupt flag bit
-	T6CONbits.T6CKPS = 0b11;		// Set up Timer6 prescale to /64
-	T6CONbits.T6OUTPS = 0b1111;		// Set up Timer6 postscale to /16
-	TMR6IE = 1;						// Enable Timer6 interrupts
-	T6CONbits.TMR6ON = 1;			// Enable Timer6
-	
 	// Read the EEPROM configuration data
 	state = eeprom_read(STATEADD);
 	offDelayTime = eeprom_read(OFFTIMEADD);
@@ -76,7 +64,7 @@ void NightSense_Init (void) {
 void NightSense_Enable (BOOL on) {
 	if (on) state = ACTIVE;
 	else state = DISABLED;
-	eeprom_write(STATEADD, state);
+	WriteByte(STATEADD, state);
 }	
 
 BOOL NightSense_IsNight (void) {
@@ -86,12 +74,12 @@ BOOL NightSense_IsNight (void) {
 
 void NightSense_SetOnDelay (unsigned char time) {
 	onDelayTime = time;
-	eeprom_write(ONTIMEADD, time);
+	WriteByte(ONTIMEADD, time);
 }
 
 void NightSense_SetOffDelay (unsigned char time) {
 	offDelayTime = time;
-	eeprom_write(OFFTIMEADD, time);
+	WriteByte(OFFTIMEADD, time);
 }
 
 void NightSense_SetDuration (unsigned int time) {
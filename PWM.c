@@ -8,174 +8,326 @@
 * \file   	PWM.c
 * \details  This module implements the Pulse-Width Modulation (PWM) timers that drive
 *			the external FETs.  Four independent hardware timers are used that can
-*			generate PWM pulses from 0 to 100% with a resolution of 10 bits.  Note:
-*			currently only the upper 8 bits of the PWM register are used.  
+*			generate PWM pulses from 0 to 100% with a resolution of 10 bits.  The
+*			8-bit intensities are mapped through a perceptual brightness (gamma)
+*			table to the full 10-bit duty cycle.  Fades run on 8.8 fixed point
+*			levels in quarter intensity steps and use a Bresenham interpolator
+*			per channel so all four channels arrive at their targets on the same
+*			tick.  The quarter steps are interpolated between the gamma table 
+*			entries so a slow fade changes the duty cycle four times as often.
+*			Short fades move several steps per tick so a full range fade can 
+*			take as little as one tick.  The PWM carrier frequency can be selected from several Timer2
+*			settings with the duty cycles rescaled to suit.  Fades can also follow
+*			one of the eased curves in Easing.inc instead of a straight line.
+*			A master dimmer and four channel dimmers scale the intensities as 
+*			they are written to the outputs, and a tempo setting speeds up or
+*			slows down every fade and hold, so a whole show can be adjusted
+*			without rewriting the sequences.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
 //************************************************************************************
 //#include "system.h"        /* System funct/params, like osc/peripheral config */
 #include "PWM.h"
-#include "NightSense.h"
+#include "Scheduler.h"
 #include "RS485.h"
+#include "MemoryMap.h"
+#include "Macros.h"
 
-#define	PERIOD		200							/*!< Desired clock in Hz - 5mS */
-#define	SCALE		64							/*!</ Timer 4 prescaler */
-#define	PRCOUNT		(IPERIOD/SCALE/PERIOD)
+#define	PERIOD		TICKRATE					/*!< Desired clock in Hz - 5mS */
+#define	SCALE		TICKSCALE					/*!</ Timer 4 prescaler */
+#define T4PRESCALE	0b11						/*!< Timer 4 prescale select for SCALE */
+#define	PRCOUNT		(IPERIOD/SCALE/PERIOD/SUBTICKS)	/*!< Timer 4 period -- SUBTICKS of these make a tick */
+#define FADESTEPS	255							/*!< ticks per eased fade unit -- a full range at one step per tick */
+#define FASTFADE	240							/*!< fade values from here up are 1 to 15 tick fades */
+#define EASEFADE	128							/*!< fade values from here to FASTFADE are eased fades */
+#define EASEUNITS	28							/*!< eased fade lengths for each curve */
+#define EASEPOINTS	64							/*!< intervals in each Easing[] curve */
+#define LINEAR		0							/*!< curve number for a linear fade */
+#define RAMPQUEUE	4							/*!< queued ramps -- must be a power of 2 */
+#define MAXTEMPO	(2*PWM_TEMPO)				/*!< fastest tempo -- two engine passes per tick */
+
+// Check at compile time that the tick is within 1% of 5mS at this clock
+#if (PRCOUNT > 256) || (100UL*PRCOUNT*SCALE*SUBTICKS*PERIOD < 99UL*IPERIOD) || (100UL*PRCOUNT*SCALE*SUBTICKS*PERIOD > 101UL*IPERIOD)
+#error "Timer4 tick is more than 1% from 5mS at this clock"
+#endif
 
 // PWM state definitions
 typedef enum _PWMState {	
 	OFF, FADING, HOLDING
 } PWMState;
 
-static unsigned int prevPWM[4];		/*!< previous pwm values */
-static unsigned int newPWM[4];		/*!< new pwm values */
-static unsigned int fadeCount;		/*!< count down fade value in 5mS increments */
-static unsigned int counter;		/*!< counter used for fade/hold count down */
-static unsigned int holdCount;		/*!< count down hold value in 5mS increments */
-static PWMState pwmState;			/*!< current PWM state */
-
-static unsigned char minuteTimer;	/*!< count up to one minute */
-
-//const unsigned char ULogTable[] = 	// Upper 8-bit logarithmic light intensity
-//{
-//	0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 
-//	0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 
-//	0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 
-//	0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x04, 
-//	0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x05, 
-//	0x05, 0x05, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 
-//	0x07, 0x07, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 
-//	0x08, 0x09, 0x09, 0x09, 0x09, 0x0A, 0x0A, 0x0A, 
-//	0x0A, 0x0B, 0x0B, 0x0B, 0x0C, 0x0C, 0x0C, 0x0D, 
-//	0x0D, 0x0D, 0x0E, 0x0E, 0x0F, 0x0F, 0x0F, 0x10, 
-//	0x10, 0x11, 0x11, 0x12, 0x12, 0x13, 0x13, 0x14, 
-//	0x14, 0x15, 0x16, 0x16, 0x17, 0x17, 0x18, 0x19, 
-//	0x1A, 0x1A, 0x1B, 0x1C, 0x1D, 0x1D, 0x1E, 0x1F, 
-//	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 
-//	0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2E, 0x2F, 0x30, 
-//	0x32, 0x33, 0x34, 0x36, 0x37, 0x39, 0x3A, 0x3C, 
-//	0x3E, 0x3F, 0x41, 0x43, 0x45, 0x47, 0x49, 0x4B, 
-//	0x4D, 0x4F, 0x51, 0x53, 0x56, 0x58, 0x5B, 0x5D, 
-//	0x60, 0x62, 0x65, 0x68, 0x6B, 0x6E, 0x71, 0x74, 
-//	0x77, 0x7B, 0x7E, 0x81, 0x85, 0x89, 0x8D, 0x90, 
-//	0x94, 0x99, 0x9D, 0xA1, 0xA6, 0xAA, 0xAF, 0xB4, 
-//	0xB9, 0xBE, 0xC3, 0xC9, 0xCE, 0xD4, 0xDA, 0xE0, 
-//	0xE6, 0xEC, 0xF3, 0xFA, 0xFF, 0xFF
-//};
-//
-//const unsigned char LLogTable[] = 	// Lower 2-bit logarithmic light intensity (compressed)
-//{
-//	0x01, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
-//	0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
-//	0x22, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x30,
-//	0x00, 0x00, 0x00, 0x00, 0x11, 0x11, 0x11, 0x12,
-//	0x22, 0x22, 0x23, 0x33, 0x33, 0x00, 0x00, 0x01,
-//	0x11, 0x12, 0x22, 0x23, 0x33, 0x00, 0x01, 0x11,
-//	0x22, 0x23, 0x30, 0x01, 0x12, 0x23, 0x30, 0x01,
-//	0x12, 0x23, 0x00, 0x12, 0x23, 0x01, 0x12, 0x30,
-//	0x12, 0x30, 0x12, 0x30, 0x12, 0x30, 0x23, 0x02,
-//	0x30, 0x23, 0x12, 0x02, 0x31, 0x31, 0x31, 0x31,
-//	0x31, 0x32, 0x02, 0x13, 0x21, 0x02, 0x10, 0x03,
-//	0x21, 0x10, 0x00, 0x00, 0x00, 0x01, 0x12, 0x30,
-//	0x12, 0x01, 0x31, 0x31, 0x32, 0x03, 0x22, 0x11,
-//	0x11, 0x12, 0x23, 0x12, 0x02, 0x03, 0x21, 0x11,
-//	0x12, 0x20, 0x13, 0x20, 0x03, 0x30, 0x12, 0x02,
-//	0x11, 0x11, 0x20, 0x21, 0x11, 0x23, 0x10, 0x33
-//};
-//
-//static unsigned char UpperLog (unsigned char index) {
-//	if (index < 47) return 0;	// compress the table
-//	if (index < 74) return 1;
-//	return ULogTable[index-74];
-//}
-//
-//static unsigned char LowerLog (unsigned char index) {
-//	unsigned char value = LLogTable[index >> 1];
-//	if (index & 1) return (value >> 4);
-//	return (value & 0xF);
-//}	
-	
-//#define SETPWM1(pwm) 	{ CCP2CONbits.DC2B = LowerLog(pwm); CCPR2L = UpperLog(pwm); } 	
-//#define SETPWM2(pwm) 	{ CCP3CONbits.DC3B = LowerLog(pwm); CCPR3L = UpperLog(pwm); }	
-//#define SETPWM3(pwm) 	{ CCP1CONbits.DC1B = LowerLog(pwm); CCPR1L = UpperLog(pwm); }	
-//#define SETPWM4(pwm) 	{ CCP4CONbits.DC4B = LowerLog(pwm); CCPR4L = UpperLog(pwm); }	
+// PWM carrier settings -- a shorter Timer2 period raises the frequency but
+// drops the low bits of the duty cycle
+typedef struct _Carrier {
+	unsigned char prescale;			/*!< Timer2 prescale select: /1, /4, /16, /64 */
+	unsigned char period;			/*!< Timer2 period register */
+	unsigned char shift;			/*!< duty cycle bits dropped from 10 bits */
+} Carrier;
+
+#ifdef CLOCK_32MHZ
+// The idle clock drops each prescale a step so none of these can be /1
+const Carrier Carriers[] = {
+	{0b11, 0xFF, 0},				// 488Hz, 10 bits at 32MHz
+	{0b10, 0xFF, 0},				// 1.95kHz, 10 bits
+	{0b01, 0xFF, 0},				// 7.8kHz, 10 bits
+	{0b01, 0x7F, 1},				// 15.6kHz, 9 bits
+	{0b01, 0x3F, 2}					// 31.3kHz, 8 bits
+};
+static unsigned char clockStep;		/*!< prescale steps dropped at the idle clock */
+#define PRESCALE(p)	((p) - clockStep)
+#else
+const Carrier Carriers[] = {
+	{0b10, 0xFF, 0},				// 244Hz, 10 bits at 4MHz (original)
+	{0b01, 0xFF, 0},				// 977Hz, 10 bits
+	{0b00, 0xFF, 0},				// 3.9kHz, 10 bits
+	{0b00, 0x7F, 1},				// 7.8kHz, 9 bits
+	{0b00, 0x3F, 2}					// 15.6kHz, 8 bits
+};
+#define PRESCALE(p)	(p)
+#endif
+#define CARRIERS	(sizeof(Carriers)/sizeof(Carrier))
+#define DEFCARRIER	0				/*!< carrier used when none has been configured */
+
+// The Timer2 interrupt writes the four duty cycles within LATCHTCY instruction cycles
+// of reading TMR2 and only starts if they will all be in before the period ends.  The
+// shortest period above, at either clock, is 64 cycles so every carrier changes all
+// four channels together as long as the interrupt gets in during the first 24.
+#define LATCHTCY	(40)
+
+// Ramp waiting in the queue for the interrupt
+typedef struct _Ramp {
+	unsigned char pwm[4];			/*!< target pwm values */
+	unsigned int step[4];			/*!< whole quarter steps per tick */
+	unsigned int delta[4];			/*!< remaining quarter steps spread over the fade */
+	unsigned char curve;			/*!< LINEAR or Easing[] curve number + 1 */
+	unsigned int fade;				/*!< fade time in 5mS ticks */
+	unsigned int hold;				/*!< hold time in 5mS ticks */
+} Ramp;
+
+static unsigned int prevPWM[4];		/*!< previous pwm levels (8.8 fixed point) */
+static unsigned int newPWM[4];		/*!< new pwm levels (8.8 fixed point) */
+static unsigned int step[4];		/*!< whole quarter steps per tick */
+static unsigned int delta[4];		/*!< remaining quarter steps spread over the fade */
+static unsigned int error[4];		/*!< Bresenham error terms */
+static unsigned char curve[4];		/*!< fade curves of the active ramps */
+static unsigned char phase[4];		/*!< positions along the eased curves from 0 to 255 */
+static unsigned int phaseError[4];	/*!< Bresenham error terms for the curve positions */
+static unsigned int base[4];		/*!< pwm levels at the start of an eased fade (8.8 fixed point) */
+static unsigned int fadeTicks[4];	/*!< fade times in 5mS ticks */
+static unsigned int fadeLeft[4];	/*!< fade ticks remaining */
+static unsigned int holdCount[4];	/*!< hold times in 5mS ticks */
+static unsigned int holdLeft[4];	/*!< hold ticks remaining */
+static PWMState pwmState[4];		/*!< current PWM state of each channel */
+
+static unsigned char lastPWM[4];	/*!< pwm values at the end of the last ramp */
+static Ramp queue[RAMPQUEUE];		/*!< ramps waiting to start */
+static volatile unsigned char queueHead;	/*!< ramps added -- only changed by PWM_Ramp */
+static volatile unsigned char queueTail;	/*!< ramps started -- only changed by the ISR */
+static unsigned int queueDrops;		/*!< ramps dropped because the queue was full */
+static unsigned char tickTime;		/*!< longest tick interrupt in Timer4 counts */
+
+static unsigned char latchL[4];		/*!< CCPRxL values written by the next Timer2 period */
+static unsigned char latchB[4];		/*!< DCxB values written by the next Timer2 period */
+static unsigned char latchLimit;	/*!< Timer2 count the latch has to start before */
+
+static unsigned char carrier;		/*!< active Carriers[] entry */
+static unsigned char dutyShift;		/*!< duty cycle rescaling for the active carrier */
+
+static unsigned char masterDim;		/*!< master dimmer for all channels */
+static unsigned char channelDim[4];	/*!< channel dimmers */
+static unsigned char dimmer[4];		/*!< combined master and channel dimmers */
+static volatile BOOL refresh;		/*!< TRUE to rewrite the outputs at the next tick */
+static unsigned char tempo;			/*!< fade/hold speed in 1/PWM_TEMPO units */
+static unsigned char tempoCount;	/*!< tempo accumulator -- one engine pass per PWM_TEMPO */
+
+// Perceptual brightness tables generated by tools/MakeGamma.c
+#include "Gamma.inc"
+
+// Eased fade curves generated by tools/MakeEasing.c
+#include "Easing.inc"
+
+// Lower 2 bits of the gamma-corrected duty cycle for intensity 'pwm'
+#define GAMMALOW(pwm)	((GammaLow[(pwm) >> 2] >> (((pwm) & 3) << 1)) & 3)
+
+// Fade levels are kept as 8.8 fixed point values and move in quarter steps
+#define LEVEL(pwm)		((unsigned int)(pwm) << 8)
+#define INTENSITY(lev)	((unsigned char)((lev) >> 8))
+#define QUARTERS(lev)	((lev) >> 6)			/*!< level in quarter steps -- a 10-bit gamma index */
+#define QUARTER			6						/*!< shift from quarter steps to a level */
+
+// Gamma index 'idx' scaled by the dimmer of channel 'ch' -- a dimmer of 255 is full intensity
+#define DIMMED(ch, idx)	((((unsigned int)((idx) >> 2) * (dimmer[ch] + 1)) + ((((idx) & 3) * (dimmer[ch] + 1)) >> 2)) >> 6)
 
-#define SETPWM1(pwm) 	{ CCP2CONbits.DC2B = 0; CCPR2L = pwm; } 	
-#define SETPWM2(pwm) 	{ CCP3CONbits.DC3B = 0; CCPR3L = pwm; }	
-#define SETPWM3(pwm) 	{ CCP1CONbits.DC1B = 0; CCPR1L = pwm; }	
-#define SETPWM4(pwm) 	{ CCP4CONbits.DC4B = 0; CCPR4L = pwm; }	
+// 10-bit duty cycle for intensity 'pwm'
+#define GAMMA(pwm)		((((unsigned int)GammaHigh[pwm]) << 2) | GAMMALOW(pwm))
+
+// Duty cycle for gamma index 'idx' interpolated between the table entries and scaled to the carrier's period
+#define DUTY(idx)		{ duty = GAMMA((idx) >> 2); \
+						  if ((idx) & 3) duty += ((GAMMA(((idx) >> 2) + 1) - duty) * ((idx) & 3)) >> 2; \
+						  duty >>= dutyShift; }
+
+// Posts level 'lev' of channel 'ch' for the Timer2 interrupt to write
+#define POSTPWM(ch, lev) { index = DIMMED(ch, QUARTERS(lev)); DUTY(index); latchB[ch] = duty & 3; latchL[ch] = duty >> 2; }
 
 //********************************************************************************
 /**
-* \details  Shared interrupt service routine for the PWM timers, night sense
-*			state machine timing, and the receive UART. 
+* \details  Shared interrupt service routine for the PWM timers, the task
+*			scheduler tick, and the receive and transmit UART. 
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
 //********************************************************************************
 static void interrupt generic_isr(void)
 {
-	unsigned char i;
-	unsigned char done;
+	unsigned char i, n, c, active;
+	BOOL faded;
+	unsigned int duty, index, move;
+	Ramp *ramp;
+
+	// PWM latch first so it starts as early in the period as it can
+	if ((TMR2IE) && (TMR2IF)) {
+		// A PWM period has just started -- write the posted duty cycles together so 
+		// they take effect at the next period boundary.  If the period is too far gone
+		// for them all to get in, wait for the next one.
+		if (TMR2 < latchLimit) {
+			CCP2CONbits.DC2B = latchB[CH1]; CCPR2L = latchL[CH1];
+			CCP3CONbits.DC3B = latchB[CH2]; CCPR3L = latchL[CH2];
+			CCP1CONbits.DC1B = latchB[CH3]; CCPR1L = latchL[CH3];
+			CCP4CONbits.DC4B = latchB[CH4]; CCPR4L = latchL[CH4];
+			TMR2IE = 0;			// one shot
+		}
+		TMR2IF = 0;				// Clear Timer2 interrupt flag bit
+	}
 
 	// PWM timer code
+#if SUBTICKS > 1
+	if ((TMR4IE) && (TMR4IF) && (++schedSubTicks < SUBTICKS)) {
+		// part way through a tick
+		TMR4IF = 0;				// Clear Timer4 interrupt flag bit
+	} else
+#endif
 	if ((TMR4IE) && (TMR4IF)) {
-		switch (pwmState) {
-			case FADING:
-				if (counter == 0) {
-					// Fade the PWM values
-					done = 0;
-					for (i=CH1; i<=CH4; i++) {
-						if (prevPWM[i] < newPWM[i]) prevPWM[i]++;
-						else if (prevPWM[i] > newPWM[i]) prevPWM[i]--;
-						else done++;
-					}
-
-					// Update the PWM outputs with new values
-					SETPWM1(prevPWM[CH1]);
-					SETPWM2(prevPWM[CH2]);
-					SETPWM3(prevPWM[CH3]);
-					SETPWM4(prevPWM[CH4]);
-
-					if (done == 4) {
-						// change to holding state
-						counter = holdCount;
-						pwmState = HOLDING;
-					} else {
-						counter = fadeCount;
-					}
+		// The tempo sets how many engine passes each tick gets -- PWM_TEMPO 
+		// is one pass per tick, half that is one pass every other tick
+		faded = FALSE;
+		tempoCount += tempo;
+		while (tempoCount >= PWM_TEMPO) {
+			tempoCount -= PWM_TEMPO;
+		
+			// Each channel runs its own fade/hold state machine
+			active = 0;
+			for (i=CH1; i<=CH4; i++) {
+				switch (pwmState[i]) {
+					case FADING:
+						if (curve[i] == LINEAR) {
+							// Move 'step' quarter steps each tick plus 'delta' extra quarter
+							// steps spread over the 'fadeTicks' ticks without passing the 
+							// target.  Only a slow fade has 'delta' above 'fadeTicks' and
+							// then by four times at most.
+							move = step[i];
+							error[i] += delta[i];
+							while (error[i] >= fadeTicks[i]) {
+								error[i] -= fadeTicks[i];
+								move++;
+							}
+							move <<= QUARTER;
+							if (prevPWM[i] < newPWM[i]) {
+								if (newPWM[i] - prevPWM[i] > move) prevPWM[i] += move;
+								else prevPWM[i] = newPWM[i];
+							} else {
+								if (prevPWM[i] - newPWM[i] > move) prevPWM[i] -= move;
+								else prevPWM[i] = newPWM[i];
+							}
+						} else {
+							// Eased fade -- the curve position moves 255 steps over 'fadeTicks'
+							// ticks and the channel is at its start plus 'delta' scaled by the curve
+							phaseError[i] += 255;
+							if (phaseError[i] >= fadeTicks[i]) {
+								phaseError[i] -= fadeTicks[i];
+								c = ++phase[i];
+								n = c >> 2;
+								c = Easing[curve[i]-1][n] + 
+									(((unsigned int)(Easing[curve[i]-1][n+1] - Easing[curve[i]-1][n]) * (c & 3)) >> 2);
+								move = (((unsigned int)(delta[i] >> 2) * c) >> 6) << QUARTER;
+								if (newPWM[i] > base[i]) prevPWM[i] = base[i] + move;
+								else prevPWM[i] = base[i] - move;
+							}
+						}
+						if (--fadeLeft[i] == 0) {
+							// change to holding state -- without a hold the channel is idle
+							// now so a queued ramp can start on this tick
+							prevPWM[i] = newPWM[i];
+							holdLeft[i] = holdCount[i];
+							if (holdCount[i] != 0) pwmState[i] = HOLDING;
+							else pwmState[i] = OFF;
+						}
+						faded = TRUE;
+						break;
+					case HOLDING:
+						if (holdLeft[i] <= 1) pwmState[i] = OFF;	// finished holding
+						else holdLeft[i]--;
+						break;
+					default:
+						// OFF state
+						break;
 				}
-				break;
-			case HOLDING:
-				if (counter == 0) {
-					pwmState = OFF;		// finished holding
+				if (pwmState[i] != OFF) active++;
+			}
+
+			// Start any queued ramp on all channels on the same tick that they're all idle
+			if ((active == 0) && (queueTail != queueHead)) {
+				ramp = &queue[queueTail & (RAMPQUEUE-1)];
+				for (i=CH1; i<=CH4; i++) {
+					fadeTicks[i] = ramp->fade;
+					fadeLeft[i] = ramp->fade;
+					holdCount[i] = ramp->hold;
+					curve[i] = ramp->curve;
+					phase[i] = 0;
+					phaseError[i] = ramp->fade >> 1;
+					newPWM[i] = LEVEL(ramp->pwm[i]);
+					base[i] = prevPWM[i];
+					step[i] = ramp->step[i];
+					delta[i] = ramp->delta[i];
+					if (ramp->fade >= FADESTEPS) {
+						// four quarter steps per tick at most -- measure from where the channel is now
+						if (newPWM[i] > base[i]) delta[i] = QUARTERS(newPWM[i] - base[i]);
+						else delta[i] = QUARTERS(base[i] - newPWM[i]);
+					}	
+					error[i] = ramp->fade >> 1;		// round to the nearest tick
+					pwmState[i] = FADING;
 				}
-				break;
-			default:
-				// OFF state
-				break;
+				queueTail++;					// free the queue entry
+				schedEvents |= PWM_EVENT;		// there's room for another ramp
+			}
 		}
-		if (counter > 0) counter--;
-		TMR4IF = 0;				// Clear Timer4 interrupt flag bit
 		
-	} else if ((TMR6IE) && (TMR6IF)) {
-		// This timer is actually for the NightSense.c logic but unfortunately only one interrupt
-		// is used for everything so this handler ends up being a bit kludgey.
-	
-		if (minuteTimer < 240)
-			minuteTimer++;
-		else {
-			minuteTimer = 0;
-			NightSense_UpdateState();
+		if (faded || refresh) {
+			// Post new values or new dimmer settings for the next PWM period
+			POSTPWM(CH1, prevPWM[CH1]);
+			POSTPWM(CH2, prevPWM[CH2]);
+			POSTPWM(CH3, prevPWM[CH3]);
+			POSTPWM(CH4, prevPWM[CH4]);
+			TMR2IE = 1;					// the fade replaces any pending PWM_Set values
+			refresh = FALSE;
 		}
-		TMR6IF = 0;				// Clear Timer6 interrupt flag bit
-
+#if SUBTICKS > 1
+		schedSubTicks = 0;
+#endif
+		schedTicks++;			// tick for the task scheduler
+		if (TMR4 > tickTime) tickTime = TMR4;	// Timer4 restarted at the tick
+		TMR4IF = 0;				// Clear Timer4 interrupt flag bit
+		
 	} else if (RCIF) {
 		// Handle the UART receive interrupt	
 		// Add character to receive buffer
 		RS485_RxBuf[RS485_WtPtr++] = RCREG;
 		
+	} else if ((TXIE) && (TXIF)) {
+		// Send the next queued character -- writing TXREG clears TXIF
+		TXREG = RS485_TxBuf[RS485_TxRdPtr & (RS485_TXSIZE-1)];
+		if (++RS485_TxRdPtr == RS485_TxWtPtr) TXIE = 0;	// nothing left to send
+		
 	} else if (IOCAF != 0) {
 		// Handle the I/O interrupt	
 		// Clear interrupt flag
@@ -183,6 +335,23 @@ static void interrupt generic_isr(void)
 	}
 }
 
+static void SetLatchLimit (void) {
+	// The latch has to start early enough in a Timer2 period to finish within it
+	unsigned char shift = T2CONbits.T2CKPS << 1;
+	
+	latchLimit = PR2 + 1 - ((LATCHTCY + (1 << shift) - 1) >> shift);
+}
+
+static void SetDimmers (void) {
+	// Combines the master and channel dimmers and rewrites the outputs
+	unsigned char i;
+	
+	for (i=CH1; i<=CH4; i++) {
+		dimmer[i] = ((unsigned int)channelDim[i] * (masterDim + 1)) >> 8;
+	}
+	refresh = TRUE;
+}
+
 //********************************************************************************
 /**
 * \details  PWM timer and I/O port initialization.
@@ -191,7 +360,10 @@ static void interrupt generic_isr(void)
 */ 
 //********************************************************************************
 void PWM_Init (void) {
+	unsigned char i;
+	
 	prevPWM[0] = 0; prevPWM[1] = 0; prevPWM[2] = 0; prevPWM[3] = 0;
+	lastPWM[0] = 0; lastPWM[1] = 0; lastPWM[2] = 0; lastPWM[3] = 0;
 	
 	APFCON1 = 0x01;					// PWM2 output on pin RA5
 	ANSELA = 0;						// All analog inputs are digital
@@ -229,9 +401,14 @@ void PWM_Init (void) {
 	CCPTMRSbits.C4TSEL = 0b00;		// Use Timer2 for this PWM
 	
 	// Set up pwm Timer 2 registers
-	PR2 = 0xFF;						// PWM period value
+	carrier = eeprom_read(CARRIERADD);
+	if (carrier >= CARRIERS) carrier = DEFCARRIER;
+	dutyShift = Carriers[carrier].shift;
+	PR2 = Carriers[carrier].period;	// PWM period value
 	PIR1bits.TMR2IF = 0;			// Clear Timer2 interrupt flag bit
-	T2CONbits.T2CKPS = 0b10;		// Set up Timer2 prescale to /16
+	TMR2IE = 0;						// Timer2 interrupts only latch posted values
+	T2CONbits.T2CKPS = PRESCALE(Carriers[carrier].prescale);	// Set up Timer2 prescale
+	SetLatchLimit();
 	T2CONbits.TMR2ON = 1;			// Enable Timer2
 	
 	// Turn on the PWM outputs
@@ -243,75 +420,404 @@ void PWM_Init (void) {
 	// Initialize Timer 4 for pwm updates
 	PR4 = PRCOUNT-1;			// PWM update period
 	PIR3bits.TMR4IF = 0;			// Clear Timer4 interrupt flag bit
-	T4CONbits.T4CKPS = 0b11;		// Set up Timer4 prescale to /64
+	T4CONbits.T4CKPS = PRESCALE(T4PRESCALE);	// Set up Timer4 prescale to /64
 	TMR4IE = 1;				// Enable Timer4 interrupts
 	PEIE = 1;				// Also enable peripheral interrupts for Timer4 use
 	T4CONbits.TMR4ON = 1;			// Enable Timer4
 	ei();					// Global interrupts enabled
 	
-	counter = 0;
-	minuteTimer = 0;
-	pwmState = OFF;				// prevent PWM action
+	queueHead = 0; queueTail = 0; queueDrops = 0;
+	tickTime = 0;
+	
+	// Dimmers default to full intensity (erased EEPROM) and the tempo to normal
+	masterDim = eeprom_read(DIMMERADD);
+	for (i=CH1; i<=CH4; i++) channelDim[i] = eeprom_read(CHDIMMERADD+i);
+	SetDimmers();
+	tempo = eeprom_read(TEMPOADD);
+	if ((tempo == 0) || (tempo > MAXTEMPO)) tempo = PWM_TEMPO;
+	tempoCount = 0;
+	pwmState[CH1] = OFF; pwmState[CH2] = OFF;	// prevent PWM action
+	pwmState[CH3] = OFF; pwmState[CH4] = OFF;
 }
 
 //********************************************************************************
 /**
 * \details  Returns \em TRUE iff the PWM state machine is currently performing a
 *			PWM fade or hold function.  Although the PWM pulses are hardware-based,
-*			the fading and hold features require software timers.
+*			the fading and hold features require software timers.  Queued 
+*			ramps that haven't started yet also count as busy.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
 //********************************************************************************
 BOOL PWM_Busy (void) {
-	return (pwmState != OFF);
+	return (pwmState[CH1] != OFF) || (pwmState[CH2] != OFF) || (pwmState[CH3] != OFF) ||
+		   (pwmState[CH4] != OFF) || (queueTail != queueHead);
+}		
+
+//********************************************************************************
+/**
+* \details  Returns \em TRUE iff the ramp queue is full so that \em PWM_Ramp 
+*			can't accept another ramp yet.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+BOOL PWM_Full (void) {
+	return (unsigned char)(queueHead - queueTail) >= RAMPQUEUE;
+}		
+
+//********************************************************************************
+/**
+* \details  Returns the number of ramps waiting in the queue behind the active
+*			fade/hold.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+unsigned char PWM_QueueDepth (void) {
+	return queueHead - queueTail;
+}		
+
+//********************************************************************************
+/**
+* \details  Returns the number of ramps that \em PWM_Ramp dropped because the
+*			queue was full.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+unsigned int PWM_Drops (void) {
+	return queueDrops;
+}		
+
+//********************************************************************************
+/**
+* \details  Returns the longest time that the tick interrupt has taken in Timer4
+*			counts.  Timer4 restarts at the tick so this is the time from the 
+*			tick to the end of the fade engine including the interrupt latency.
+* \author   agent
+* \date   	17 Oct 2026
+*/ 
+//********************************************************************************
+unsigned char PWM_TickTime (void) {
+	return tickTime;
 }		
 
+//********************************************************************************
+/**
+* \details  Selects PWM carrier \em mode (see Carriers[]) and saves it in 
+*			internal EEPROM.  The outputs are rescaled at the next Timer2 
+*			period.  Returns \em FALSE if the mode doesn't exist.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+BOOL PWM_SetCarrier (unsigned char mode) {
+	unsigned int duty, index;
+	unsigned char i;
+	
+	if (mode >= CARRIERS) return FALSE;
+	WriteByte(CARRIERADD, mode);
+	
+	TMR4IE = 0;
+	TMR2IE = 0;
+	carrier = mode;
+	T2CONbits.T2CKPS = PRESCALE(Carriers[mode].prescale);
+	PR2 = Carriers[mode].period;
+	dutyShift = Carriers[mode].shift;
+	SetLatchLimit();
+	
+	// relatch the present outputs with the new scaling
+	for (i=CH1; i<=CH4; i++) POSTPWM(i, prevPWM[i]);
+	TMR2IE = 1;
+	TMR4IE = 1;
+	return TRUE;
+}	
+
+//********************************************************************************
+/**
+* \details  Returns the active PWM carrier mode, its frequency in Hz, and the
+*			number of duty cycle bits of resolution.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+unsigned char PWM_GetCarrier (unsigned int *frequency, unsigned char *bits) {
+	*frequency = (IPERIOD >> (Carriers[carrier].prescale << 1)) / ((unsigned int)Carriers[carrier].period + 1);
+	*bits = 10 - Carriers[carrier].shift;
+	return carrier;
+}	
+
+#ifdef CLOCK_32MHZ
+//********************************************************************************
+/**
+* \details  Rescales Timer2 and Timer4 for a clock change so the carrier and
+*			the 5mS tick keep their rates.  The idle clock is a quarter of the 
+*			full clock which is exactly one prescale step.  Call with interrupts
+*			disabled.
+* \author   agent
+* \date   	17 Oct 2026
+*/ 
+//********************************************************************************
+void PWM_SetClock (BOOL full) {
+	clockStep = full ? 0 : 1;
+	T2CONbits.T2CKPS = PRESCALE(Carriers[carrier].prescale);
+	T4CONbits.T4CKPS = PRESCALE(T4PRESCALE);
+	SetLatchLimit();
+}
+#endif
+
+//********************************************************************************
+/**
+* \details  Sets the dimmer for channel \em ch, or for all channels when \em ch
+*			is PWM_MASTER, and saves it in internal EEPROM.  The channel 
+*			intensities are scaled by (level+1)/256 of both dimmers when they are
+*			written to the outputs so 255 is full intensity.  The outputs change 
+*			at the next tick.  Returns \em FALSE if the channel doesn't exist.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+BOOL PWM_SetDimmer (unsigned char ch, unsigned char level) {
+	if (ch == PWM_MASTER) {
+		WriteByte(DIMMERADD, level);
+		masterDim = level;
+	} else if (ch <= CH4) {
+		WriteByte(CHDIMMERADD+ch, level);
+		channelDim[ch] = level;
+	} else return FALSE;
+	SetDimmers();
+	return TRUE;
+}	
+
+//********************************************************************************
+/**
+* \details  Returns the dimmer for channel \em ch or the master dimmer when 
+*			\em ch is PWM_MASTER.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+unsigned char PWM_GetDimmer (unsigned char ch) {
+	if (ch <= CH4) return channelDim[ch];
+	return masterDim;
+}	
+
+//********************************************************************************
+/**
+* \details  Sets the fade/hold tempo and saves it in internal EEPROM.  PWM_TEMPO
+*			is normal speed; each unit above or below it speeds up or slows 
+*			down every fade and hold by 1/PWM_TEMPO, including ones in progress.
+*			Returns \em FALSE if the tempo is 0 or faster than MAXTEMPO.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+BOOL PWM_SetTempo (unsigned char speed) {
+	if ((speed == 0) || (speed > MAXTEMPO)) return FALSE;
+	WriteByte(TEMPOADD, speed);
+	tempo = speed;
+	return TRUE;
+}	
+
+//********************************************************************************
+/**
+* \details  Returns the fade/hold tempo where PWM_TEMPO is normal speed.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+unsigned char PWM_GetTempo (void) {
+	return tempo;
+}	
+
 //********************************************************************************
 /**
 * \details  Override the active PWM fade/hold functions by setting fixed PWM 
-*			outputs for the four channels.  The pwm value is applied during the 
-*			next PWM period.  Function returns immmediately.  PWM values range 
-*			from 0 to PWM_MAX where PWM_MAX represents 100% duty cycle.
+*			outputs for the four channels.  The duty cycles are posted for the
+*			interrupt to write early in the next Timer2 period, so all four 
+*			channels change together in the following PWM period.  Function
+*			returns immmediately.  PWM values range from 0 to PWM_MAX where 
+*			PWM_MAX represents 100% duty cycle.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
 //********************************************************************************
 void PWM_Set (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4) {
-	pwmState = OFF;	// Stop ramping now
-	__delay_ms(10);	// Wait for next interrupt
+	unsigned int duty, index;
+	
+	TMR4IE = 0;
+	TMR2IE = 0;				// the interrupt can't latch the values until TMR2IE is set
+	queueTail = queueHead;	// Drop any queued ramps
+	pwmState[CH1] = OFF; pwmState[CH2] = OFF;	// Stop ramping now
+	pwmState[CH3] = OFF; pwmState[CH4] = OFF;
+	prevPWM[CH1] = LEVEL(pwm1); prevPWM[CH2] = LEVEL(pwm2);	// a dimmer refresh rewrites all four
+	prevPWM[CH3] = LEVEL(pwm3); prevPWM[CH4] = LEVEL(pwm4);
+	lastPWM[CH1] = pwm1; lastPWM[CH2] = pwm2;
+	lastPWM[CH3] = pwm3; lastPWM[CH4] = pwm4;
 	
-	prevPWM[CH1] = pwm1; SETPWM1(pwm1);
-	prevPWM[CH2] = pwm2; SETPWM2(pwm2);
-	prevPWM[CH3] = pwm3; SETPWM3(pwm3);
-	prevPWM[CH4] = pwm4; SETPWM4(pwm4);
+	// Post the new values -- a stale TMR2IF is safe since the latch checks TMR2
+	POSTPWM(CH1, prevPWM[CH1]);
+	POSTPWM(CH2, prevPWM[CH2]);
+	POSTPWM(CH3, prevPWM[CH3]);
+	POSTPWM(CH4, prevPWM[CH4]);
+	TMR2IE = 1;
+	TMR4IE = 1;
 }	
 
+//********************************************************************************
+/**
+* \details  Drops any queued ramps and stops every channel's fade/hold at the
+*			value it has reached.  The outputs are left alone so the next ramp
+*			fades from what is showing now without a dark frame.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+void PWM_Stop (void) {
+	unsigned char i;
+	
+	TMR4IE = 0;
+	queueTail = queueHead;	// Drop any queued ramps
+	for (i=CH1; i<=CH4; i++) {
+		pwmState[i] = OFF;
+		lastPWM[i] = INTENSITY(prevPWM[i]);
+		prevPWM[i] = LEVEL(lastPWM[i]);
+	}
+	TMR4IE = 1;
+}	
+
+static unsigned char Distance (unsigned char from, unsigned char to) {
+	// Returns how many whole steps a channel moves going from 'from' to 'to'
+	if (to > from) return to - from;
+	return from - to;
+}
+
+static unsigned char FadeCurve (unsigned char fade, unsigned char move, unsigned int *ticks) {
+	// Returns the curve selected by a segment 'fade' value and its length in 'ticks'.  A 
+	// linear fade takes fade+1 ticks for each step of the channel that moves furthest, 
+	// 'move', as the original firmware did, but 0 is immediate.
+	if (fade >= FASTFADE) {
+		*ticks = fade - FASTFADE + 1;
+		return LINEAR;
+	}
+	if (fade >= EASEFADE) {
+		fade -= EASEFADE;
+		*ticks = FADESTEPS*(unsigned int)(fade % EASEUNITS + 1);
+		return fade / EASEUNITS + 1;
+	}	
+	*ticks = (fade + 1) * (unsigned int)move;
+	if ((fade == 0) || (*ticks == 0)) *ticks = 1;
+	return LINEAR;
+}
+
+static unsigned int FadeSteps (unsigned char from, unsigned char to, unsigned int ticks, unsigned int *delta) {
+	// Returns the whole quarter steps per tick to go from 'from' to 'to' in 'ticks' with
+	// the remaining quarter steps in 'delta'.  A fade of FADESTEPS ticks or more can't 
+	// need more than four quarter steps per tick.
+	unsigned int steps;
+	
+	steps = (unsigned int)Distance(from, to) << 2;
+	if (ticks >= FADESTEPS) {
+		*delta = steps;
+		return 0;
+	}
+	*delta = steps % (unsigned char)ticks;
+	return steps / (unsigned char)ticks;
+}
+
 //********************************************************************************
 /**
 * \details 	Ramps from the previous pwm values for all channels to the passed pwm
-*			value over the fade time which has units of 10 milliseconds.  The hold
-*			time has units of 50 milliseconds.  The total fade/hold function takes 
-*			fade*5 + hold*50 milliseconds.  This function returns immediately and
-*			will prevent another PWM fade/hold event until the current event has
-*			completed.  See also the \em PWM_Busy function.
+*			values.  Fade values from 1 to 127 take fade+1 ticks (5 milliseconds)
+*			for each step of the channel that moves furthest, as the original 
+*			firmware did, and 0 changes the values on the next tick.  Fade values
+*			from FASTFADE up (240 to 254) are short fades of 1 to 15 ticks (5 to
+*			75 milliseconds).  Fade values from EASEFADE to 239 are eased fades 
+*			of 1 to EASEUNITS times 1.275 seconds (a full range at one step per
+*			tick): 128-155 ease in, 156-183 ease out, 184-211 S-curve, and 
+*			212-239 exponential.
+*			All channels finish together regardless of how far they move.  The 
+*			hold time has units of 50 milliseconds.  This function returns 
+*			immediately.
+*			The ramp is queued and started by the interrupt on the same tick 
+*			that the previous fade/hold completes so consecutive ramps play
+*			without a gap.  Up to RAMPQUEUE ramps can wait in the queue; when
+*			it is full the ramp is dropped, counted, and FALSE is returned.
+*			See also the \em PWM_Busy, \em PWM_Full, \em PWM_QueueDepth and
+*			\em PWM_Drops functions.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
 //********************************************************************************
-void PWM_Ramp (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4, 
+BOOL PWM_Ramp (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4, 
 			   unsigned char fade, unsigned char hold) {
-	if (pwmState != OFF) return;			// don't add a new ramp until the current one is finished
+	unsigned char i, move;
+	unsigned int ticks;
+	Ramp *ramp;
+	
+	if (PWM_Full()) {
+		queueDrops++;				// no room for another ramp
+		return FALSE;
+	}	
 
 	// Initialize the next ramping stage
-	newPWM[CH1] = pwm1;
-	newPWM[CH2] = pwm2;
-	newPWM[CH3] = pwm3;
-	newPWM[CH4] = pwm4;
-	holdCount = 10*(unsigned int)hold;
-	fadeCount = fade;
+	ramp = &queue[queueHead & (RAMPQUEUE-1)];
+	ramp->pwm[CH1] = pwm1;
+	ramp->pwm[CH2] = pwm2;
+	ramp->pwm[CH3] = pwm3;
+	ramp->pwm[CH4] = pwm4;
+	ramp->hold = 10*(unsigned int)hold;
+	move = 0;
+	for (i=CH1; i<=CH4; i++) {
+		if (Distance(lastPWM[i], ramp->pwm[i]) > move) move = Distance(lastPWM[i], ramp->pwm[i]);
+	}	
+	ramp->curve = FadeCurve(fade, move, &ticks);
+	ramp->fade = ticks;
+	
+	// Work out the per tick steps once for the whole fade
+	for (i=CH1; i<=CH4; i++) {
+		ramp->step[i] = FadeSteps(lastPWM[i], ramp->pwm[i], ticks, &ramp->delta[i]);
+		lastPWM[i] = ramp->pwm[i];
+	}		
 	
-	// Start next ramping now
-	counter = fadeCount;
-	pwmState = FADING;
+	// Hand the ramp to the interrupt
+	queueHead++;
+	return TRUE;
 }	
+
+//********************************************************************************
+/**
+* \details 	Retargets channel \em ch to \em pwm from its present value with its 
+*			own \em fade and \em hold (same units as \em PWM_Ramp) without 
+*			disturbing the other channels.  The ramp starts immediately and 
+*			replaces any fade/hold that the channel was doing.  Queued ramps for
+*			all channels wait until this channel is idle too.  Used by the SBUS
+*			RAMP command.
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//********************************************************************************
+void PWM_RampChannel (unsigned char ch, unsigned char pwm, unsigned char fade, unsigned char hold) {
+	unsigned int ticks;
+	unsigned char c;
+	
+	if (ch > CH4) return;
+	c = FadeCurve(fade, Distance(INTENSITY(prevPWM[ch]), pwm), &ticks);
+	
+	TMR4IE = 0;						// keep the interrupt out while the channel changes
+	step[ch] = FadeSteps(INTENSITY(prevPWM[ch]), pwm, ticks, &delta[ch]);
+	curve[ch] = c;
+	fadeTicks[ch] = ticks;
+	fadeLeft[ch] = ticks;
+	holdCount[ch] = 10*(unsigned int)hold;
+	phase[ch] = 0;
+	phaseError[ch] = ticks >> 1;
+	error[ch] = ticks >> 1;
+	base[ch] = prevPWM[ch];
+	newPWM[ch] = LEVEL(pwm);
+	lastPWM[ch] = pwm;
+	pwmState[ch] = FADING;
+	TMR4IE = 1;
+}
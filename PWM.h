@@ -9,22 +9,76 @@
 #define CH4		3
 
 #define PWM_MAX	255
+#define PWM_MASTER	4			// dimmer for all channels
+#define PWM_TEMPO	64			// normal fade/hold tempo
+#define PWM_EVENT	0x01		// scheduler event posted when a queued ramp starts
 
 extern void PWM_Init (void);
 
 extern BOOL PWM_Busy (void);
 
+extern BOOL PWM_Full (void);
+// Returns TRUE iff the ramp queue has no room for another ramp.
+
+extern unsigned char PWM_QueueDepth (void);
+// Returns the number of ramps queued behind the active one.
+
+extern unsigned int PWM_Drops (void);
+// Returns the number of ramps dropped because the queue was full.
+
+extern unsigned char PWM_TickTime (void);
+// Returns the longest tick interrupt (the fade engine) in Timer4 counts.
+
+extern BOOL PWM_SetCarrier (unsigned char mode);
+// Select and save the PWM carrier frequency mode.  Returns FALSE for an 
+// unknown mode.
+
+extern unsigned char PWM_GetCarrier (unsigned int *frequency, unsigned char *bits);
+// Returns the active carrier mode, its frequency in Hz, and its duty
+// cycle resolution in bits.
+
+#ifdef CLOCK_32MHZ
+extern void PWM_SetClock (BOOL full);
+// Rescales the PWM timers after a change between the full and idle clocks.
+#endif
+
+extern BOOL PWM_SetDimmer (unsigned char ch, unsigned char level);
+// Set and save the dimmer for channel ch or PWM_MASTER.  255 is full 
+// intensity.  Returns FALSE for an unknown channel.
+
+extern unsigned char PWM_GetDimmer (unsigned char ch);
+// Returns the dimmer for channel ch or PWM_MASTER.
+
+extern BOOL PWM_SetTempo (unsigned char speed);
+// Set and save the fade/hold tempo where PWM_TEMPO is normal speed.  
+// Returns FALSE if the tempo is out of range.
+
+extern unsigned char PWM_GetTempo (void);
+// Returns the fade/hold tempo.
+
 extern void PWM_Set (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4);
 // Set the pwm value for channel ch.  The pwm value is
 // applied during the next PWM period.  Function returns
 // immmediately.  pwm value ranges from 0 to PWM_MAX where
 // PWM_MAX represents 100% modulation.
 
-extern void PWM_Ramp (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4, 
+extern void PWM_Stop (void);
+// Drops any queued ramps and stops all channels at their present values
+// so the next ramp fades from there.
+
+extern BOOL PWM_Ramp (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4, 
 					  unsigned char fade, unsigned char hold);
-// Ramps from the previous pwm value for channel ch to the passed pwm
-// value over the fade time which has units of 10 milliseconds.  The hold
-// time has units of 50 milliseconds.  This function takes fade*10 + hold*50 
-// milliseconds before it returns.
+// Ramps from the previous pwm values to the passed pwm values.  A fade
+// from 1 to 127 takes fade+1 ticks (5 mS) for each step of the channel
+// that moves furthest and 0 is immediate; 128 up select the eased and
+// short fades described in PWM.c.  All channels arrive at their targets
+// together.  The hold time has units of 50 milliseconds.
+// The ramp is queued and starts as soon as the previous fade/hold completes.
+// Returns FALSE if the queue was full and the ramp was dropped.  This 
+// function returns immediately.
+
+extern void PWM_RampChannel (unsigned char ch, unsigned char pwm, unsigned char fade, unsigned char hold);
+// Ramps channel ch alone from its present value to pwm with its own fade 
+// and hold without disturbing the other channels.  Starts immediately.
 
 #endif
\ No newline at end of file
@@ -11,8 +11,8 @@
 *			the pushbutton is held down.  If held down for 5 seconds, a \em HOLD state
 *			is entered; otherwise, a \em PRESSED state is set.  Each pushbutton has
 *			an independent state machine.  Both state machines are sequenced by the
-*			\em Scan function which is invoked periodically every 10mS by an shared
-*			interrupt routine in the PWM module.  
+*			\em Scan function which is invoked periodically every 10mS by the task
+*			scheduler.  
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -127,8 +127,8 @@ static void Scan (PBState* state, unsigned int* tim, unsigned char pb) {
 
 //********************************************************************************
 /**
-* \details  Interrupt-driven pushbutton scan function.  See also the PWM module
-*			for details on the interrupt handler that calls this function.
+* \details  Pushbutton scan function.  See also the task table in main.c which
+*			runs this function every 10mS.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
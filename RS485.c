@@ -11,6 +11,13 @@
 *			is defined here but is written to by the shared interrupt routine in the
 *			PWM module.  This code also automatically handles the half-duplex RS-485
 *			mode switches between receive and transmit operation. 
+*
+*			Characters to send are queued in a transmit ring buffer that the same
+*			interrupt routine drains as the UART asks for them, so a write only 
+*			waits if the buffer is full.  The first write turns the driver on and
+*			the UART starts on the next RS485_CharReady() call, which gives the 
+*			host a tick to release the bus.  RS485_CharReady() turns the driver
+*			back off once the buffer is empty and the last stop bit has gone.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -23,20 +30,41 @@
 
 #if HIGH_SPEED == 1
 #define SPEED 0x4
+#define DIVIDER		16UL
 #else
 #define SPEED 0
+#define DIVIDER		64UL
+#endif
+
+// Baud rate generator count at clock 'f' rounded to the nearest and the baud rate it gives
+#define BRGCOUNT(f)	(((f) + DIVIDER*BAUD/2) / (DIVIDER*BAUD))
+#define BAUDRATE(f)	((f) / (DIVIDER*BRGCOUNT(f)))
+#define BAUDOK(f)	((BRGCOUNT(f) <= 256) && (BAUDRATE(f) >= BAUD*99UL/100) && (BAUDRATE(f) <= BAUD*101UL/100))
+
+// Check at compile time that the baud rate is within 1% at each clock
+#if !BAUDOK(_XTAL_FREQ)
+#error "RS485 baud rate is more than 1% off at this clock"
+#endif
+#ifdef CLOCK_32MHZ
+#if !BAUDOK(IDLE_FREQ)
+#error "RS485 baud rate is more than 1% off at the idle clock"
+#endif
 #endif
 
 #define RX_PIN TRISB5
 #define TX_PIN TRISB7
 
-#define Enable_Transmit()	LATCbits.LATC0 = 1; LATCbits.LATC4 = 1; __delay_ms(5); TxActive=TRUE;
-#define Enable_Receive()	__delay_ms(5); LATCbits.LATC0 = 0; LATCbits.LATC4 = 0; TxActive=FALSE;
+#define Enable_Transmit()	LATCbits.LATC0 = 1; LATCbits.LATC4 = 1; TxActive=TRUE; TxStarted=FALSE;
+#define Enable_Receive()	LATCbits.LATC0 = 0; LATCbits.LATC4 = 0; TxActive=FALSE;
 
-static BOOL TxActive;
+static BOOL TxActive;				// the driver is on
+static BOOL TxStarted;				// the transmit interrupt may run
 unsigned char RS485_RxBuf[256];		// receive buffer
 unsigned char RS485_RdPtr;			// read pointer
 unsigned char RS485_WtPtr;			// write pointer (interrupt)
+unsigned char RS485_TxBuf[RS485_TXSIZE];	// transmit buffer
+volatile unsigned char RS485_TxRdPtr;	// transmit read pointer (interrupt)
+unsigned char RS485_TxWtPtr;		// transmit write pointer
 
 /* Serial initialization */
 void RS485_Init (void) {
@@ -48,7 +76,7 @@ void RS485_Init (void) {
 	// Set up hardware UART
 	RX_PIN = 1;
 	TX_PIN = 0;
-	SPBRG = (_XTAL_FREQ/(16UL * BAUD) - 1);   
+	SPBRG = BRGCOUNT(_XTAL_FREQ) - 1;   
 	RCSTA = 0x90;
 	TXSTA = (SPEED|0x20);
 	
@@ -61,10 +89,17 @@ void RS485_Init (void) {
 
 void putch(unsigned char byte) 
 {
-	/* output one byte */
-	while (!TXIF)	/* set when register is empty */
-		continue;
-	TXREG = byte;
+	/* queue one byte for the transmit interrupt */
+	if ((unsigned char)(RS485_TxWtPtr - RS485_TxRdPtr) >= RS485_TXSIZE) {
+		// full -- start sending now and wait for room
+		TxStarted = TRUE;
+		TXIE = 1;
+		while ((unsigned char)(RS485_TxWtPtr - RS485_TxRdPtr) >= RS485_TXSIZE)
+			continue;
+	}
+	RS485_TxBuf[RS485_TxWtPtr & (RS485_TXSIZE-1)] = byte;
+	RS485_TxWtPtr++;
+	if (TxStarted) TXIE = 1;
 }
 
 unsigned char getch() {
@@ -92,8 +127,35 @@ void RS485_Write(unsigned char buffer[], unsigned int size) {
 	while (size > 0) { putch(buffer[index++]); size--; }
 }
 
+#ifdef CLOCK_32MHZ
+void RS485_SetClock (BOOL full) {
+	// Reload the baud rate generator after a clock change
+	if (full) SPBRG = BRGCOUNT(_XTAL_FREQ) - 1;
+	else SPBRG = BRGCOUNT(IDLE_FREQ) - 1;
+}
+
+#endif
+
+BOOL RS485_Idle (void) {
+	// Nothing being shifted in, queued, or sent
+	return (BAUDCONbits.RCIDL && !TxActive);
+}
+
+unsigned char RS485_TxRoom (void) {
+	return RS485_TXSIZE - (unsigned char)(RS485_TxWtPtr - RS485_TxRdPtr);
+}
+
 BOOL RS485_CharReady (void) {
-	if (TxActive) Enable_Receive();
+	if (TxActive) {
+		// start sending after the turnaround or release the bus once it's all gone
+		if (!TxStarted) {
+			TxStarted = TRUE;
+			TXIE = 1;
+		} else if ((RS485_TxRdPtr == RS485_TxWtPtr) && TXSTAbits.TRMT) {
+			Enable_Receive();
+		}
+		if (TxActive) return FALSE;		/* half duplex -- nothing arrives while sending */
+	}
 	return (RS485_RdPtr != RS485_WtPtr);		/* check for received characters */
 }		
 
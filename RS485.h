@@ -3,15 +3,31 @@
 
 #include "Types.h"
 
+#define RS485_TXSIZE	64					// transmit buffer -- must be a power of 2
+
 extern unsigned char RS485_RxBuf[256];		// receive buffer
 extern unsigned char RS485_RdPtr;			// read pointer
 extern unsigned char RS485_WtPtr;			// write pointer (interrupt)
+extern unsigned char RS485_TxBuf[RS485_TXSIZE];	// transmit buffer
+extern volatile unsigned char RS485_TxRdPtr;	// transmit read pointer (interrupt)
+extern unsigned char RS485_TxWtPtr;			// transmit write pointer
 
 void RS485_Init (void);
 
 #define RS485_ClearBuffer()		RS485_RdPtr = 0; RS485_WtPtr = 0
 BOOL RS485_CharReady (void);
 
+BOOL RS485_Idle (void);
+// Returns TRUE when no character is being received and the driver is off.
+
+unsigned char RS485_TxRoom (void);
+// Returns how many characters can be written without waiting.
+
+#ifdef CLOCK_32MHZ
+void RS485_SetClock (BOOL full);
+// Reloads the baud rate after a change between the full and idle clocks.
+#endif
+
 void RS485_WriteChar(unsigned char ch);
 void RS485_Write(unsigned char buffer[], unsigned int size);
 
@@ -24,6 +24,37 @@
 *			(without quotes) would be sent: ":FF60FFFF00"<CR><LF> and this reply is 
 *			received: ":FF60FFFF00050501680000003DFF003D00"<CR><LF>.  Refer to the 
 *			user manual or code for more details on the protocol commands.
+*
+*			Frames are parsed a character at a time as they arrive so a slow or
+*			truncated frame never holds up the caller.  Each call consumes the
+*			received characters and dispatches at most one complete frame.  A
+*			":" always starts a new frame so the parser resynchronizes after a
+*			truncated one.  Replies are queued in the RS-485 transmit buffer and
+*			sent by the interrupt.  READSEGS, READMACROS, and full REPORT replies
+*			can be longer than the buffer so they are streamed: each call queues
+*			as much as there is room for and no frames are read until the whole
+*			reply has gone.  Each READSEGS sequence is still read from EEPROM in
+*			one go.  See tools/SBUSSplit.c for a host test of the parser.
+*
+*			A fixture can nap while its outputs are off, but only once the host
+*			has turned napping on with a CONFIGURE of the \em NAPADD item, which
+*			is off until then.  A napping fixture wakes on the first start bit
+*			of a frame but that character is lost, so after the bus has been 
+*			quiet the host should send any character other than ":" (a CR for
+*			example) before the first frame.
+*
+*			The same commands can also be sent as binary frames which are about
+*			half the size.  A binary frame is an STX (0x02) followed by the raw
+*			device, command, and address bytes, then the data as chunks of a 
+*			length byte (1 to 255) and that many data bytes, then a zero length
+*			byte, and finally the CRC-16 (Modbus polynomial, low byte first) of
+*			everything after the STX.  Nothing is escaped.  Every device follows
+*			the binary frames on the bus but only answers them once the host
+*			has enabled them with a CONFIGURE of the \em BINARYMODE item, which
+*			is cleared at power up.  A binary frame is answered with a binary
+*			frame and an ASCII frame with an ASCII frame.  The host should wait
+*			for the frame time-out after abandoning a binary frame part way.  
+*			See tools/SBUSFrame.c for a host encoder and decoder.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -38,9 +69,11 @@
 #include "NightSense.h"
 #include "Macros.h"
 #include "PWM.h"
+#include "Scheduler.h"
 
 #define CR			(0x0D)
 #define LF			(0x0A)
+#define STX			(0x02)		// start of a binary frame
 #define READSEGS	(0x10)
 #define WRITESEGS	(0x20)
 #define RUNSEGS		(0x30)
@@ -50,8 +83,18 @@
 #define READMACROS	(0x70)
 #define WRITEMACROS	(0x80)
 #define DISPLAY		(0x90)
+#define RAMP		(0xA0)
 
-#define TIMEOUT		(500)		// time-out between characters in mS
+#define TIMEOUT		(100)		// time-out between characters in calls (one per 5 mS tick)
+#define HEADER		(4)			// device, command, and address bytes that start a frame
+#define TASKREPORT	(0x0100)	// report item for the scheduler task timing
+#define DUTYREPORT	(0x0101)	// report item for the CPU duty cycle
+#define BINARYMODE	(0x0102)	// configure/report item that enables binary frames
+#define TICKREPORT	(0x0103)	// report item for the tick interrupt time
+#define QUEUEREPORT	(0x0104)	// report item for the ramp queue depth and drops
+#define CHUNK		(32)		// most data bytes in each binary reply chunk
+#define STEPROOM	(CHUNK+4)	// most characters one step of a streamed reply queues
+#define NOTHEX		(0xFF)		// fromHex() result for a character that isn't hexadecimal
 #define ERROR		(0xFFFF)
 #define ERRSTATUS	(0xEF00)
 
@@ -60,39 +103,47 @@ extern unsigned int maxAddress, minAddress;	// sequence start and end address (d
 extern BOOL override;						// override outputs via SBUS (defined in main.c)
 extern BOOL playMacros;						// play EEPROM macros if TRUE (defined in main.c)
 
+// Frame parser states -- the binary frame states come last
+typedef enum _RxState {	
+	IDLE, HIGHNIBBLE, LOWNIBBLE, SKIPFRAME, BINHEADER, BINLENGTH, BINDATA, BINCRCLOW, BINCRCHIGH
+} RxState;
+
 static unsigned char parameters[256];
 static unsigned char deviceAdd;	
 
+static RxState rxState;			// frame parser state
+static unsigned char rxHigh;	// high nibble of the byte being received
+static unsigned int rxCount;	// bytes received in this frame
+static unsigned int rxTimer;	// calls since the last character
+static unsigned char deviceID;	// header of the frame being received
+static unsigned char command;
+static unsigned int address;
+
+static BOOL binaryMode;			// binary frames are answered (set by the host)
+static BOOL binary;				// the frame being received and answered is binary
+static BOOL rxSkip;				// binary frame isn't for us or is too long
+static unsigned char rxLeft;	// data bytes left in the binary chunk
+static unsigned char rxCRCLow;	// low byte of the received CRC
+static unsigned int crc;		// CRC of the binary frame being received or sent
+static unsigned char txChunk[CHUNK];	// binary reply data not yet sent
+static unsigned char txCount;
+
+static unsigned char replyCommand;	// command whose reply is being streamed or 0
+static unsigned int replyLeft;		// sequences, macros, or report items still to send
+static unsigned int replyIndex;		// next macro or report item, or byte of the sequence
+static unsigned int replySize;		// bytes of the sequence in 'parameters'
+
 void SBUS_Init (void) {
 	RS485_Init();
 	deviceAdd = eeprom_read(DEVICEADD);		// protocol address 
+	rxState = IDLE;
+	rxTimer = 0;
+	binaryMode = FALSE;
+	replyCommand = 0;
 }
 
-static BOOL checkChar (unsigned char expectedChar) {
-	unsigned int timer = TIMEOUT;
-	unsigned char ch = 0x00;
-	
-	while (timer > 0 && ch != expectedChar) {
-		if (RS485_CharReady()) {
-			ch = RS485_ReadChar();
-			timer = TIMEOUT;
-		}	
-		__delay_ms(1); timer--;
-	}
-	return (ch == expectedChar);	
-}
-
-static BOOL getChar (unsigned char * receivedChar) {
-	unsigned int timer = TIMEOUT;
-	
-	while (timer > 0) {
-		if (RS485_CharReady()) {
-			*receivedChar = RS485_ReadChar();
-			return TRUE;
-		}	
-		__delay_ms(1); timer--;
-	}
-	return FALSE;	
+BOOL SBUS_Idle (void) {
+	return (rxTimer >= TIMEOUT) && (replyCommand == 0) && RS485_Idle();
 }
 
 static unsigned char toHex (unsigned char nibble) {
@@ -104,35 +155,60 @@ static unsigned char fromHex (unsigned char hex) {
 	if (hex >= 'A' && hex <= 'F') return (hex - ('A' - 10));
 	else if (hex >= 'a' && hex <= 'f') return (hex - ('a' - 10));
 	else if (hex >= '0' && hex <= '9') return (hex - '0');
-	else return 0;
+	else return NOTHEX;
 }	
 
-static unsigned int getByte (void) {
-	unsigned char ch;
-	unsigned char byte;
+static unsigned int updateCRC (unsigned int crc, unsigned char byte) {
+	// Adds 'byte' to a CRC-16 with the Modbus polynomial (0xA001 reflected)
+	unsigned char i;
 	
-	if (getChar(&byte)) {
-		if (getChar(&ch)) return ((fromHex(byte) << 4) | fromHex(ch));
+	crc ^= byte;
+	for (i=0; i<8; i++) {
+		if (crc & 1) crc = (crc >> 1) ^ 0xA001;
+		else crc >>= 1;
 	}
-	return ERROR;	
+	return crc;
+}
+
+static unsigned int getWord (unsigned int index) {
+	// Returns the data word at 'index' in the received frame or ERROR if the frame is too short
+	if (index+2 > rxCount-HEADER) return ERROR;
+	return (((unsigned int)parameters[index] << 8) | parameters[index+1]);	
+}
+
+static unsigned int dataLength (void) {
+	// Returns the number of data bytes in the received frame -- ASCII frames end with an LRC
+	if (binary) return rxCount-HEADER;
+	return rxCount-HEADER-1;
+}
+
+static void sendRaw (unsigned char byte) {
+	// Sends a byte of a binary frame and adds it to the CRC
+	crc = updateCRC(crc, byte);
+	RS485_WriteChar(byte);
 }
 
-static unsigned int getWord (void) {
-	unsigned int word = getByte();
-	unsigned int result;
+static void sendChunk (void) {
+	// Sends the buffered binary reply data as one chunk
+	unsigned char i;
 	
-	if (word == ERROR) return ERROR;
-	result = getByte();
-	if (result == ERROR) return ERROR;
-	return ((word << 8) | result);	
+	if (txCount == 0) return;
+	sendRaw(txCount);
+	for (i=0; i<txCount; i++) sendRaw(txChunk[i]);
+	txCount = 0;
 }
 
 static void sendByte (unsigned char byte) {
 	unsigned char buf[2];
 	
-	buf[0] = toHex(byte >> 4);
-	buf[1] = toHex(byte & 0x0F);
-	RS485_Write(buf, 2); 
+	if (binary) {
+		txChunk[txCount++] = byte;
+		if (txCount == CHUNK) sendChunk();
+	} else {
+		buf[0] = toHex(byte >> 4);
+		buf[1] = toHex(byte & 0x0F);
+		RS485_Write(buf, 2); 
+	}
 }
 
 static void sendWord (unsigned int word) {
@@ -141,11 +217,19 @@ static void sendWord (unsigned int word) {
 }
 
 static void sendPrefix (unsigned char id, unsigned char cmd, unsigned int address) {
-	RS485_WriteChar(':');
-	sendByte(id);
-	sendByte(cmd);
-	sendWord(address);
-	cmd = address >> 8;
+	if (binary) {
+		RS485_WriteChar(STX);
+		crc = 0xFFFF; txCount = 0;
+		sendRaw(id);
+		sendRaw(cmd);
+		sendRaw(address >> 8);
+		sendRaw(address & 0xFF);
+	} else {
+		RS485_WriteChar(':');
+		sendByte(id);
+		sendByte(cmd);
+		sendWord(address);
+	}
 }
 
 static void sendString (const unsigned char str[]) {
@@ -153,24 +237,73 @@ static void sendString (const unsigned char str[]) {
 }
 
 static void endOfMessage (void) {
-	sendString("00\r\n");   // end of message
+	unsigned int check;
+	
+	if (binary) {
+		sendChunk();
+		sendRaw(0);				// end of the chunks
+		check = crc;
+		RS485_WriteChar(check & 0xFF);
+		RS485_WriteChar(check >> 8);
+	} else {
+		sendString("00\r\n");   // end of message
+	}
 }
 
-static unsigned int readParameters (void) {
-	unsigned int command, length;
+static BOOL receiveByte (unsigned char byte) {
+	// Stores the next byte of the frame.  Returns FALSE for frames for other 
+	// devices and frames too long for 'parameters' so they can be skipped.
+	BOOL keep = TRUE;
+	
+	switch (rxCount) {
+		case 0:
+			deviceID = byte;
+			keep = (deviceID == 0xFF || deviceID == deviceAdd);
+			break;
+		case 1: command = byte; break;
+		case 2: address = (unsigned int)byte << 8; break;
+		case 3: address |= byte; break;
+		default:
+			if (rxCount-HEADER < sizeof(parameters)) parameters[rxCount-HEADER] = byte;
+			else keep = FALSE;
+			break;
+	}
+	rxCount++;
+	return keep;
+}
 
-	length = 0;
-	for (;;) {
-		command = getByte();
-		if (command == ERROR || length>255) break;
-		parameters[length++] = command;
+static BOOL receiveBinary (unsigned char byte) {
+	// Steps the binary frame parser.  Returns TRUE once a complete frame for this
+	// device has arrived with a good CRC.
+	if (rxState < BINCRCLOW) crc = updateCRC(crc, byte);
+	switch (rxState) {
+		case BINHEADER:
+			if (!receiveByte(byte)) rxSkip = TRUE;
+			if (rxCount == HEADER) rxState = BINLENGTH;
+			break;
+		case BINLENGTH:
+			rxLeft = byte;
+			if (rxLeft == 0) rxState = BINCRCLOW;		// end of the chunks
+			else rxState = BINDATA;
+			break;
+		case BINDATA:
+			if (!rxSkip && !receiveByte(byte)) rxSkip = TRUE;
+			if (--rxLeft == 0) rxState = BINLENGTH;
+			break;
+		case BINCRCLOW:
+			rxCRCLow = byte;
+			rxState = BINCRCHIGH;
+			break;
+		default:
+			rxState = IDLE;
+			return (!rxSkip && binaryMode && (crc == (((unsigned int)byte << 8) | rxCRCLow)));
 	}
-	return (length-2);
+	return FALSE;
 }
 
 static sendReportItem (unsigned int item) {
-	unsigned int length;
-	unsigned char onTime, offTime;
+	unsigned int length, polls, maxPolls, hits, flushes, busy, awake;
+	unsigned char onTime, offTime, bits, task;
 	BOOL flag;
 	
 	NightSense_GetParam(&flag, &length, &onTime, &offTime);
@@ -183,189 +316,311 @@ static sendReportItem (unsigned int item) {
 		case TOTALSEQADD: sendWord(ReadWord(item)); break;
 		case DEVICEADD: sendByte(deviceAdd); break;
 		case (DEVICEADD+1): sendWord(Seq_Count()); break;
+		case (DEVICEADD+2):
+			// EEPROM write cycles, total and maximum acknowledge polls (not in the full report)
+			EEPROM_GetStats(&length, &polls, &maxPolls);
+			sendWord(length); sendWord(polls); sendWord(maxPolls); break;
+		case (DEVICEADD+3):
+			// EEPROM page cache merged writes and pages written (not in the full report)
+			EEPROM_GetCacheStats(&hits, &flushes);
+			sendWord(hits); sendWord(flushes); break;
+		case CARRIERADD:
+			// PWM carrier mode, frequency in Hz, and duty cycle bits (not in the full report)
+			sendByte(PWM_GetCarrier(&length, &bits));
+			sendWord(length); sendByte(bits); break;
+		case DIMMERADD: sendByte(PWM_GetDimmer(PWM_MASTER)); break;
+		case TEMPOADD: sendByte(PWM_GetTempo()); break;
+		case CHDIMMERADD:
+		case (CHDIMMERADD+1):
+		case (CHDIMMERADD+2):
+		case (CHDIMMERADD+3): sendByte(PWM_GetDimmer(item-CHDIMMERADD)); break;
+		case XFADEADD: sendByte(eeprom_read(XFADEADD)); break;
+		case NAPADD: sendByte(eeprom_read(NAPADD)); break;
+		case TASKREPORT:
+			// task count, worst case task times in Timer4 counts, and tick overruns (not in the full report)
+			sendByte(Sched_GetCount());
+			for (task=0; task<Sched_GetCount(); task++) sendWord(Sched_GetWorst(task));
+			sendWord(Sched_Overruns()); break;
+		case DUTYREPORT:
+			// time running tasks and time awake over the last second in 0.1% (not in the full report)
+			Sched_GetDuty(&busy, &awake);
+			sendWord(busy); sendWord(awake); break;
+		case BINARYMODE: sendByte(binaryMode); break;
+		case TICKREPORT:
+			// longest tick interrupt in Timer4 counts (not in the full report)
+			sendByte(PWM_TickTime()); break;
+		case QUEUEREPORT:
+			// queued ramps and ramps dropped with the queue full (not in the full report)
+			sendByte(PWM_QueueDepth()); sendWord(PWM_Drops()); break;
 		default: break;
 	}
 }
 
-static sendAllReportItems () {
-	unsigned int item;
+static void continueReply (void) {
+	// Queues as much of a streamed reply as there is room for and ends the frame
+	// once all of it is queued
+	while (RS485_TxRoom() >= STEPROOM) {
+		if (replyLeft == 0) {
+			endOfMessage();
+			replyCommand = 0;
+			return;
+		}
+		switch (replyCommand) {
+			case READSEGS:
+				if (replyIndex == replySize) {
+					// next sequence -- its size and then its data
+					replySize = Seq_CopyToBuffer(address, parameters);
+					replyIndex = 0;
+					if (replySize == 0) replyLeft = 0;
+					else sendByte(replySize);
+				} else {
+					sendByte(parameters[replyIndex++]);  // send sequence data
+					if (replyIndex == replySize) { address++; replyLeft--; }
+				}
+				break;
+			case READMACROS:
+				sendWord(Macros_Read(replyIndex++));
+				replyLeft--;
+				break;
+			default:
+				sendReportItem(STATEADD + replyIndex++);	// full report
+				replyLeft--;
+				break;
+		}
+	}
+}
+
+static void startReply (unsigned char cmd, unsigned int count) {
+	// Streams 'count' sequences, macros, or report items after the reply prefix
+	replyCommand = cmd;
+	replyLeft = count;
+	replyIndex = 0;
+	replySize = 0;
+	continueReply();
+}
+
+static void dispatchFrame (void) {
+	// Carries out the command in a complete frame and sends the reply
+	BOOL flag;
+	unsigned int length, index, i;
 	
-	for (item=STATEADD; item<(DEVICEADD+2); item++) {
-		sendReportItem(item);
+	switch (command) {
+		case READSEGS:
+			length = getWord(0);
+						
+			// read EEPROM or FLASH contents
+			sendPrefix(deviceID, READSEGS, address);
+			if (length != ERROR) {
+				sendWord(length);
+				startReply(READSEGS, length);
+				return;
+			} else sendWord(ERRSTATUS | READSEGS);
+			break;
+			
+		case WRITESEGS:
+			length = dataLength();
+			
+			// write the seqences to memory
+			sendPrefix(deviceID, WRITESEGS, address);
+			if (length >= BYTESPERSEQ) {
+				// extract RGBW, hold, fade and add to or create a sequence
+				index = (length / BYTESPERSEQ) * BYTESPERSEQ;
+				if (address != 0xFFFF) flag = Seq_AddToMulti(address, parameters, index / BYTESPERSEQ);
+				else flag = Seq_New_Multi(parameters, index / BYTESPERSEQ);
+				if (flag && (length == index)) sendWord(index);
+				else sendWord(ERRSTATUS | WRITESEGS);
+			} else sendWord(ERRSTATUS | WRITESEGS);						
+			break;
+			
+		case RUNSEGS:
+			length = getWord(0);
+			
+			// set up the run parameters
+			sendPrefix(deviceID, RUNSEGS, address);
+			if ((length != ERROR) && Seq_Find(address) == FIND_OK && Seq_Find(address+length-1) == FIND_OK) {
+				WriteWord (STARTSEQADD, address);
+				WriteWord (TOTALSEQADD, length);
+				minAddress = address;
+				maxAddress = address+length-1;
+				sendWord(length);
+				activeSequence = minAddress;
+				override = FALSE;
+			} else sendWord(ERRSTATUS | RUNSEGS);
+			break;
+			
+		case DISPLAY:
+			length = getWord(0);
+			
+			// set up the run parameters
+			sendPrefix(deviceID, DISPLAY, address);
+			if (length != ERROR) {
+				override = TRUE;
+				PWM_Set (address >> 8, address & 0xFF, length >> 8, length & 0xFF);
+				sendWord(length);
+			} else sendWord(ERRSTATUS | DISPLAY);
+			break;
+			
+		case RAMP:
+			length = dataLength();
+			
+			// ramp one channel to a new value with its own fade and hold
+			sendPrefix(deviceID, RAMP, address);
+			if ((address <= CH4) && (length == 3)) {
+				override = TRUE;
+				PWM_RampChannel (address, parameters[0], parameters[1], parameters[2]);
+				sendWord(length);
+			} else sendWord(ERRSTATUS | RAMP);
+			break;
+			
+		case ERASESEGS:
+			length = getWord(0);
+			
+			// erase the segments in this range
+			sendPrefix(deviceID, ERASESEGS, address);
+			if ((length != ERROR) && Seq_Delete_Range (address, length)) sendWord(length);						
+			else sendWord(ERRSTATUS | ERASESEGS);	
+			break;
+			
+		case CONFIGURE:
+			length = getWord(0);
+			
+			// update the configuration parameter
+			sendPrefix(deviceID, CONFIGURE, address);
+			if (length == ERROR) address = 0xFFFF;	// no value -- not a configuration item
+			switch (address) {
+				case STATEADD: NightSense_Enable(length != 0); break;
+				case OFFTIMEADD: NightSense_SetOffDelay(length); break;
+				case ONTIMEADD: NightSense_SetOnDelay(length); break;
+				case DURATIONADD: NightSense_SetDuration(length); break;
+				case STARTSEQADD:
+				case TOTALSEQADD: WriteWord(address, length); break;
+				case DEVICEADD: WriteByte(address, length); deviceAdd = length; break;
+				case CARRIERADD: if ((length > 255) || !PWM_SetCarrier(length)) address = 0xFFFF; break;
+				case DIMMERADD: if ((length > 255) || !PWM_SetDimmer(PWM_MASTER, length)) address = 0xFFFF; break;
+				case TEMPOADD: if ((length > 255) || !PWM_SetTempo(length)) address = 0xFFFF; break;
+				case CHDIMMERADD:
+				case (CHDIMMERADD+1):
+				case (CHDIMMERADD+2):
+				case (CHDIMMERADD+3): if ((length > 255) || !PWM_SetDimmer(address-CHDIMMERADD, length)) address = 0xFFFF; break;
+				case XFADEADD: if (length > 255) address = 0xFFFF; else WriteByte(address, length); break;
+				case NAPADD: if (length > 1) address = 0xFFFF; else WriteByte(address, length); break;
+				case BINARYMODE: if (length > 1) address = 0xFFFF; else binaryMode = length; break;
+				default: address = 0xFFFF;	
+			}	
+			if (address == 0xFFFF) sendWord(ERRSTATUS | CONFIGURE); 
+			else sendWord(length);
+			break;
+			
+		case REPORT:
+			// reply with this configuration parameter
+			sendPrefix(deviceID, REPORT, address);
+			if (address == 0xFFFF) {
+				startReply(REPORT, DEVICEADD+2-STATEADD);
+				return;
+			} else sendReportItem(address);
+			break;
+			
+		case READMACROS:
+			length = getWord(0);
+			
+			// set up the run parameters
+			sendPrefix(deviceID, READMACROS, address);
+			if (address == 0xFFFF) length = Macros_Count();
+			if ((length != ERROR) && (length <= Macros_Count())) {
+				sendWord(length);
+				startReply(READMACROS, length);
+				return;
+			} else sendWord(ERRSTATUS | READMACROS);
+			break;
+			
+		case WRITEMACROS:
+			length = dataLength();
+			
+			// Write macros to EEPROM
+			sendPrefix(deviceID, WRITEMACROS, address);
+			if ((address == 0) && ((length>>1) < MAXMACROS)) {
+				sendWord(length); address = length;
+				for (i=0; i+1<length; i+=2) {
+					Macros_Add(((unsigned int)parameters[i] << 8) | parameters[i+1]);
+				}
+				if (address > 0) {
+					activeSequence = 0;
+					minAddress = activeSequence;
+					maxAddress = activeSequence+Macros_Count()-1;
+					WriteWord(STARTSEQADD, PLAYMACROS);	 	// enable macro playback
+					playMacros = TRUE;
+				}							
+			} else sendWord(ERRSTATUS | WRITEMACROS);	
+			break;
+			
+		default:
+			if (binary) return;		// unknown binary commands get no reply
+			break;			// ignore command
 	}
-}							
+	endOfMessage();						
+}
 
 void SBUS_Process_Command (void) {
-	unsigned char ch, onTime, offTime, deviceID;
-	BOOL flag;
-	unsigned int command, address, length, index, i, size;
+	unsigned char ch, nibble;
+	BOOL complete, ready;
 	
-	if (RS485_CharReady()) {
+	ready = RS485_CharReady();		// also turns the driver around
+	if (replyCommand != 0) {
+		// the rest of a long reply goes before the next frame is read
+		continueReply();
+		return;
+	}
+	if (!ready) {
+		// drop a frame whose characters have stopped arriving
+		if (rxTimer < TIMEOUT) rxTimer++;
+		else rxState = IDLE;
+		return;
+	}	
+	while (RS485_CharReady()) {
 		ch = RS485_ReadChar();
-		if (ch == ':') {
-			// valid start of command
-			deviceID = getByte();
-			if (deviceID == 0xFF || deviceID == deviceAdd) {
-				// received valid starting byte 'FF' or should be our internal address
-				command = getByte();	// retrieve the next command byte
-				address = getWord(); 	// retrieve the address
-				switch (command) {
-					case READSEGS:
-						length = getWord();
-						checkChar(LF);		// skip the LRC, CR, and LF	
-									
-						// read EEPROM or FLASH contents
-						sendPrefix(deviceID, READSEGS, address); sendWord(length);
-						if (command != ERROR) {
-							while (length > 0) {
-								size = Seq_CopyToBuffer(address, parameters);
-								if (size == 0) break;
-								sendByte(size);
-								for (i=0; i<size; i++) sendByte(parameters[i]);  // send sequence data
-								address++; length--;
-							}
-						} else sendWord(ERRSTATUS | READSEGS);
-						break;
-						
-					case WRITESEGS:
-						length = readParameters();
-						
-						// write the seqences to memory
-						sendPrefix(deviceID, WRITESEGS, address);
-						if (length >= BYTESPERSEQ) {
-							index = 0;							
-							while (length >= BYTESPERSEQ) {
-								// extract RGBW, hold, fade and add to or create a sequence
-								if (address != 0xFFFF) {
-									if (!Seq_AddTo(address, &parameters[index+2], parameters[index+1], parameters[index])) 
-										break;
-								} else {
-									if (!Seq_New(&parameters[index+2], parameters[index+1], parameters[index]))
-										break;
-									address = Seq_GetActive();  // any more blocks will be added to this sequence
-								}
-								length -= BYTESPERSEQ; index += BYTESPERSEQ;	
-							}	
-							if (length == 0) sendWord(index);
-							else sendWord(ERRSTATUS | WRITESEGS);
-						} else sendWord(ERRSTATUS | WRITESEGS);						
-						break;
-						
-					case RUNSEGS:
-						length = getWord();
-						checkChar(LF);		// skip the LRC, CR, and LF
-						
-						// set up the run parameters
-						sendPrefix(deviceID, RUNSEGS, address);
-						if (Seq_Find(address) == FIND_OK && Seq_Find(address+length-1) == FIND_OK) {
-							WriteWord (STARTSEQADD, address);
-							WriteWord (TOTALSEQADD, length);
-							minAddress = address;
-							maxAddress = address+length-1;
-							sendWord(length);
-							activeSequence = minAddress;
-							override = FALSE;
-						} else sendWord(ERRSTATUS | RUNSEGS);
-						break;
-						
-					case DISPLAY:
-						length = getWord();
-						checkChar(LF);		// skip the LRC, CR, and LF
-						
-						// set up the run parameters
-						sendPrefix(deviceID, DISPLAY, address);
-						override = TRUE;
-						PWM_Set (address >> 8, address & 0xFF, length >> 8, length & 0xFF);
-						sendWord(length);
-						break;
-						
-					case ERASESEGS:
-						length = getWord();
-						checkChar(LF);		// skip the LRC, CR, and LF
-						
-						// erase the segments in this range
-						sendPrefix(deviceID, ERASESEGS, address);
-						if (Seq_Delete_Range (address, length)) sendWord(length);						
-						else sendWord(ERRSTATUS | ERASESEGS);	
-						break;
-						
-					case CONFIGURE:
-						length = getWord();
-						checkChar(LF);		// skip the LRC, CR, and LF
-						
-						// update the configuration parameter
-						sendPrefix(deviceID, CONFIGURE, address);
-						switch (address) {
-							case STATEADD: NightSense_Enable(length != 0); break;
-							case OFFTIMEADD: NightSense_SetOffDelay(length); break;
-							case ONTIMEADD: NightSense_SetOnDelay(length); break;
-							case DURATIONADD: NightSense_SetDuration(length); break;
-							case STARTSEQADD:
-							case TOTALSEQADD: WriteWord(address, length); break;
-							case DEVICEADD: eeprom_write(address, length); deviceAdd = length; break;
-							default: address = 0xFFFF;	
-						}	
-						if (address == 0xFFFF) sendWord(ERRSTATUS | CONFIGURE); 
-						else sendWord(length);
-						break;
-						
-					case REPORT:
-						checkChar(LF);		// skip the LRC, CR, and LF
-						
-						// reply with this configuration parameter
-						sendPrefix(deviceID, REPORT, address);
-						if (address == 0xFFFF) sendAllReportItems();
-						else sendReportItem(address);
-						break;
-						
-					case READMACROS:
-						length = getWord();
-						checkChar(LF);		// skip the LRC, CR, and LF
-						
-						// set up the run parameters
-						sendPrefix(deviceID, READMACROS, address);
-						if (address == 0xFFFF) length = Macros_Count();
-						if (length <= Macros_Count()) {
-							sendWord(length);
-							for (i=0; i<length; i++) {
-								sendWord(Macros_Read(i));
-							}	
-						} else sendWord(ERRSTATUS | READMACROS);
-						break;
-						
-					case WRITEMACROS:
-						length = readParameters();
-						
-						// Write macros to EEPROM
-						sendPrefix(deviceID, WRITEMACROS, address);
-						if ((address == 0) && ((length>>1) < MAXMACROS)) {
-							sendWord(length); address = length;
-							while (length >= 2) {
-								Macros_Add(((unsigned int)parameters[length] << 8) | parameters[length+1]);
-								length -= 2;
-							}
-							if (address > 0) {
-								activeSequence = 0;
-								minAddress = activeSequence;
-								maxAddress = activeSequence+Macros_Count()-1;
-								WriteWord(STARTSEQADD, PLAYMACROS);	 	// enable macro playback
-								playMacros = TRUE;
-							}							
-						} else sendWord(ERRSTATUS | WRITEMACROS);	
-						break;
-						
-					default:
-						checkChar(LF);	// ignore command
+		rxTimer = 0;
+		if (rxState >= BINHEADER) {
+			// every character of a binary frame is frame data
+			if (receiveBinary(ch)) {
+				binary = TRUE;
+				dispatchFrame();
+				return;				// one frame per call
+			}
+		} else if (ch == ':') {
+			// valid start of command -- also abandons any truncated frame
+			rxState = HIGHNIBBLE;
+			rxCount = 0;
+		} else if (ch == STX) {
+			// start of a binary frame
+			rxState = BINHEADER;
+			rxCount = 0;
+			rxSkip = FALSE;
+			crc = 0xFFFF;
+		} else if (ch == LF) {
+			// end of frame -- handle it if it's complete and for us
+			complete = (rxState == HIGHNIBBLE || rxState == LOWNIBBLE) && (rxCount > HEADER);
+			rxState = IDLE;
+			if (complete) {
+				binary = FALSE;
+				dispatchFrame();
+				return;				// one frame per call
+			}	
+		} else if (ch != CR) {
+			// anything but hexadecimal abandons the frame (such as the tail of a
+			// binary frame whose STX was lost)
+			nibble = fromHex(ch);
+			if (nibble == NOTHEX) {
+				if (rxState != IDLE) rxState = SKIPFRAME;
+			} else {
+				switch (rxState) {
+					case HIGHNIBBLE: rxHigh = nibble; rxState = LOWNIBBLE; break;
+					case LOWNIBBLE: 
+						rxState = HIGHNIBBLE; 
+						if (!receiveByte((rxHigh << 4) | nibble)) rxState = SKIPFRAME; 
 						break;
+					default: break;		// ignore everything up to the next frame
 				}
-				endOfMessage();						
-			}	
-		} else {
-			// ignore everything up to next LF or time-out
-			checkChar(LF);
+			}
 		}
 	}
-	RS485_ClearBuffer();
-}	
-	
-
+}
@@ -7,4 +7,7 @@ void SBUS_Init (void);
 
 void SBUS_Process_Command(void);
 
+BOOL SBUS_Idle (void);
+// Returns TRUE once nothing has been received for the frame time-out.
+
 #endif
@@ -0,0 +1,201 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	Scheduler.c
+* \details  This module implements a cooperative task scheduler that is driven by
+*			the 5mS Timer4 tick of the PWM module.  Each task in the table runs to
+*			completion every \em period ticks and also whenever one of its events
+*			is posted by the shared interrupt routine.  Tasks run in table order so
+*			the buttons, protocol, playback, and maintenance work interleave the
+*			same way on every tick.  The longest run of each task is measured with
+*			Timer4 so the worst case load can be checked over SBUS.  The tick
+*			and event counters are defined here but are written to by the shared
+*			interrupt routine in the PWM module.
+*
+*			When there is nothing to do the caller can let the CPU nap between
+*			ticks.  A nap is a SLEEP that the watchdog ends after about 4mS or a
+*			received start bit ends sooner, so a tick is never missed.  Timer4 
+*			stops while asleep so the napped time is added to the tick count.
+*			The watchdog runs from the untrimmed LFINTOSC so its period can be
+*			tens of percent off, and Timer4 can't measure a nap, so while napping
+*			the ticks and the tasks timed by them, such as the NightSense minutes,
+*			run fast or slow by the same amount.  Napping is off by default.
+*			The busy and awake time over each second is kept as a duty cycle.
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include "Scheduler.h"
+
+// Nominal watchdog nap time in mS.  The LFINTOSC behind the watchdog is not 
+// trimmed so a real nap can be tens of percent either side of this and no
+// timer runs during the nap to correct it -- napped ticks carry that error.
+#define NAPMS		(4)
+#define TICKMS		(5)					// scheduler tick in mS
+#define DUTYTICKS	(200)				// ticks in each duty cycle measurement
+#define TICKCOUNTS	((unsigned int)(PR4+1)*SUBTICKS)	// Timer4 counts in a tick
+
+volatile unsigned char schedTicks;		// 5mS ticks (interrupt)
+volatile unsigned char schedEvents;		// posted events (interrupt)
+volatile unsigned char schedSubTicks;	// Timer4 periods into the tick (interrupt)
+
+static const Task *taskTable;			// scheduled tasks
+static unsigned char taskCount;			// number of scheduled tasks
+static unsigned int countdown[MAXTASKS];	// ticks until each task is due
+static unsigned int worst[MAXTASKS];	// longest run of each task in Timer4 counts
+static unsigned char lastTick;			// tick of the last scheduler pass
+static unsigned int overruns;			// passes that started more than one tick late
+
+static unsigned char napTime;			// napped mS not yet added to the ticks
+static unsigned char passTick;			// tick and Timer4 count at the start of the last pass
+static unsigned int passCount;
+static unsigned long busyCounts;		// Timer4 counts spent in passes this measurement
+static unsigned int sleptTicks;		// ticks spent napping this measurement
+static unsigned int dutyTicks;			// ticks in this measurement
+static unsigned int busyDuty;			// busy time over the last measurement (0.1%)
+static unsigned int awakeDuty;			// awake time over the last measurement (0.1%)
+
+static unsigned char Sample (unsigned int *count) {
+	// Returns the tick count and the Timer4 count within the tick
+	unsigned char tick, sub;
+
+	do {
+		tick = schedTicks;
+		sub = schedSubTicks;
+		*count = sub * (unsigned int)(PR4+1) + TMR4;
+	} while ((tick != schedTicks) || (sub != schedSubTicks));	// read again if the tick changed
+	return tick;
+}
+
+static unsigned long Elapsed (unsigned char tick, unsigned int count, unsigned char *nowTick, unsigned int *nowCount) {
+	// Returns the Timer4 counts since 'tick' and 'count' and samples the time now
+	unsigned long time;
+
+	*nowTick = Sample(nowCount);
+	time = (unsigned long)(unsigned char)(*nowTick - tick) * TICKCOUNTS;
+	return time + *nowCount - count;
+}
+
+static BOOL Nap (void) {
+	// Sleep until the watchdog or a received start bit wakes the CPU.  Returns
+	// FALSE if something other than the watchdog ended the nap.
+	WDTCONbits.WDTPS = 0b00010;			// 4mS watchdog period
+	BAUDCONbits.WUE = 1;				// wake on a falling edge at RX
+	WDTCONbits.SWDTEN = 1;
+	CLRWDT();
+//*************************************************************************************     	  				
+	SLEEP();
+//*************************************************************************************     	  				
+	NOP();
+	WDTCONbits.SWDTEN = 0;
+	BAUDCONbits.WUE = 0;
+	if (STATUSbits.nTO == 0) {
+		// the watchdog ended the nap -- Timer4 was stopped so count the time here
+		napTime += NAPMS;
+		if (napTime >= TICKMS) {
+			napTime -= TICKMS;
+			di();
+			schedTicks++;
+			ei();
+			sleptTicks++;
+		}
+		return TRUE;
+	}
+	return FALSE;
+}
+
+void Sched_Init (const Task tasks[], unsigned char count) {
+	unsigned char i;
+
+	if (count > MAXTASKS) count = MAXTASKS;
+	taskTable = tasks;
+	taskCount = count;
+	for (i=0; i<count; i++) {
+		countdown[i] = tasks[i].period;
+		worst[i] = 0;
+	}
+	overruns = 0;
+	lastTick = schedTicks;
+	napTime = 0;
+	busyCounts = 0; sleptTicks = 0; dutyTicks = 0;
+	busyDuty = 1000; awakeDuty = 1000;
+	passTick = Sample(&passCount);
+}
+
+void Sched_Run (BOOL nap) {
+	unsigned char i, elapsed, events, startTick, endTick;
+	unsigned int startCount, endCount;
+	unsigned long time;
+	const Task *task;
+	BOOL napping;
+
+	// The last pass and any work since then count as busy time
+	busyCounts += Elapsed(passTick, passCount, &endTick, &endCount);
+	
+	// Wait for the next tick -- once a received character or a button wakes 
+	// the CPU it stays awake for the rest of the wait so the frame isn't lost
+	napping = nap;
+	while (schedTicks == lastTick) {
+		if (napping) napping = Nap();
+	}
+	passTick = Sample(&passCount);
+	elapsed = passTick - lastTick;
+	lastTick += elapsed;
+	if ((elapsed > 1) && !nap) overruns++;		// the last pass ran into this tick
+	
+	// Work out the duty cycle once a second
+	dutyTicks += elapsed;
+	if (dutyTicks >= DUTYTICKS) {
+		busyDuty = (busyCounts * 1000) / ((unsigned long)dutyTicks * TICKCOUNTS);
+		awakeDuty = 1000 - ((unsigned long)sleptTicks * 1000) / dutyTicks;
+		if (busyDuty > awakeDuty) busyDuty = awakeDuty;
+		busyCounts = 0; sleptTicks = 0; dutyTicks = 0;
+	}
+
+	// Collect the posted events
+	di();
+	events = schedEvents;
+	schedEvents = 0;
+	ei();
+
+	for (i=0; i<taskCount; i++) {
+		task = &taskTable[i];
+		if (task->period != 0) {
+			if (countdown[i] > elapsed) countdown[i] -= elapsed;
+			else countdown[i] = 0;
+		}
+		if (((task->period != 0) && (countdown[i] == 0)) || (events & task->event)) {
+			countdown[i] = task->period;
+
+			// Run the task and time it
+			startTick = Sample(&startCount);
+			task->run();
+			time = Elapsed(startTick, startCount, &endTick, &endCount);
+			if (time > 0xFFFF) time = 0xFFFF;		// longer than worst[] can hold
+			if (time > worst[i]) worst[i] = time;
+		}
+	}
+}
+
+unsigned int Sched_GetWorst (unsigned char task) {
+	if (task >= taskCount) return 0;
+	return worst[task];
+}
+
+unsigned char Sched_GetCount (void) {
+	return taskCount;
+}
+
+unsigned int Sched_Overruns (void) {
+	return overruns;
+}
+
+void Sched_GetDuty (unsigned int *busy, unsigned int *awake) {
+	*busy = busyDuty;
+	*awake = awakeDuty;
+}
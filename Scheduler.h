@@ -0,0 +1,47 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "Types.h"
+
+#define MAXTASKS	(8)				// most tasks in a task table
+
+#define TICKSPERMINUTE	(12000)		// 5mS ticks in a minute
+
+#define TICKRATE	(200)				// ticks per second (5mS)
+#define TICKSCALE	(64)				// Timer4 prescale at the full clock
+#define SUBTICKS	((IPERIOD/TICKSCALE/TICKRATE + 255)/256)	// Timer4 periods per tick so PR4 fits in 8 bits
+
+// Scheduled task -- run every 'period' ticks and/or whenever 'event' is posted
+typedef struct _Task {
+	void (*run)(void);				// run-to-completion task function
+	unsigned int period;			// 5mS ticks between runs (0 for event only)
+	unsigned char event;			// event bits that also run the task
+} Task;
+
+extern volatile unsigned char schedTicks;	// 5mS ticks (counted by the PWM interrupt)
+extern volatile unsigned char schedEvents;	// posted events (set by the PWM interrupt)
+extern volatile unsigned char schedSubTicks;	// Timer4 periods into the tick (counted by the PWM interrupt)
+
+extern void Sched_Init (const Task tasks[], unsigned char count);
+// Starts scheduling the 'count' tasks in 'tasks'.
+
+extern void Sched_Run (BOOL nap);
+// Waits for the next tick and runs every task that is due.  If 'nap' is TRUE the 
+// CPU sleeps while it waits.  Only nap while the PWM outputs are off.
+
+extern unsigned int Sched_GetWorst (unsigned char task);
+// Returns the longest time that 'task' has run in Timer4 counts (64 instruction 
+// cycles at the full clock -- 64uS at 4MHz or 8uS at 32MHz).  Runs longer than
+// 65535 counts are reported as 65535.
+
+extern unsigned char Sched_GetCount (void);
+// Returns the number of scheduled tasks.
+
+extern unsigned int Sched_Overruns (void);
+// Returns the number of times the tasks ran past the next tick.
+
+extern void Sched_GetDuty (unsigned int *busy, unsigned int *awake);
+// Returns the time spent running tasks and the time awake over the last second
+// in tenths of a percent.
+
+#endif
@@ -10,6 +10,22 @@
 *			contained routines it is possible to define, delete, and read sequences
 *			which are stored in external EEPROM.  Each sequence consists of of one
 *			or more entries of fade, hold, and PWM settings for four channels. 
+*
+*			Sequences are stored as a log: new segments are appended at the end
+*			of the used EEPROM and a directory maps each sequence number to the
+*			location of its segments.  A sequence that is extended when it isn't
+*			at the end of the log is moved to the end and its old copy becomes
+*			garbage.  Deleted sequences also become garbage.  \em Seq_Compact
+*			reclaims the garbage a step at a time while the controller is idle.
+*
+*			Each copy of a sequence in the log (an extent) starts with a mark
+*			and a tag.  The mark says whether the extent is live or dead and is
+*			changed before the directory so the log alone always tells which
+*			extents are current.  The tags increase with the sequence number so
+*			\em Seq_RebuildIndex can restore the numbering after power is lost
+*			part way through an update.  Sequences stored by the original 
+*			firmware, which have no extent headers, are converted in place the
+*			first time \em Seq_Init finds them.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -17,89 +33,339 @@
 
 #include "Sequences.h"
 #include "EEPROM.h" 
+#include "Clock.h"
+
+// The sequence directory lives in the top DIRSIZE bytes of the external EEPROM (just
+// below the MAGIC number).  Entry 'n' holds the start address and segment count of
+// sequence 'n' so that a sequence can be located without walking the sequences that
+// precede it.  The header holds the sequence count, the end of the log, and the number
+// of garbage bytes in the log.  Each sequence is stored as an extent header, its segments,
+// and an ENDMARK, and the log is terminated by a second ENDMARK.  The directory holds the
+// address of the first segment.  The header is the extent mark and a 16-bit tag.  Garbage
+// left by compaction is marked as a hole (a HOLE mark and the hole size) or, when it's too
+// short for that, as PAD bytes so the log can be walked from the start.  While compaction
+// slides an extent down the journal records how far the slide got, while sequences are
+// deleted it holds the range of their tags, and while the original log is converted it
+// records how far the conversion got.
+#define DIRSIZE		(4096)			// bytes reserved for the sequence directory
+#define DIRVALID	(0xA5)			// directory header marker when the index is current
+#define DIRHEADER	(8)				// header: valid marker, sequence count, log end, garbage
+#define DIRENTRY	(4)				// entry: start address, segment count
+#define DIRCHUNK	(16)			// directory entries per EEPROM transfer
+#define EXTHEADER	(3)				// extent header: mark, tag
+#define LIVE		(0x4C)			// extent marks
+#define DEAD		(0x44)
+#define HOLE		(0x48)
+#define PAD			(0x00)
+#define PAGESIZE	(64)			// EEPROM write page -- a write within a page is all or nothing
+#define JOURNAL		(DIRHEADER+EEMAX*DIRENTRY)	// slide journal after the directory entries
+#define SLIDING		(0x53)			// journal markers while an extent slides down,
+#define DELETING	(0x58)			//   sequences are deleted, or the original log
+#define MIGRATING	(0x4D)			//   is converted
 
 static unsigned int activeSeq;		// active sequence address
 static unsigned int activeIndex;	// address of sequence in FLASH/EEPROM
 static unsigned int lastSeq;		// last sequence address in FLASH/EEPROM
 static unsigned int lastIndex;		// address of last sequence
+static unsigned int seqTotal;		// number of sequences in the directory
+static unsigned int logEnd;			// address of the ENDMARK that terminates the log
+static unsigned int garbage;		// bytes in the log that don't belong to a sequence
+static unsigned int compactAdd;		// log below this address has been compacted
+static unsigned int dirAdd;			// start of the sequence directory
+static BOOL dirValid;				// directory header currently marked as valid
+static Segment segment;				// active segment cached from EEPROM
+static BOOL segmentValid;			// TRUE if 'segment' holds the segment at activeIndex
 static BOOL EEPROMPresent;			// set to TRUE if EEPROM is present
+static BOOL deleting;				// a deletion was cut short -- kill any extents tagged
+static unsigned int deleteFirst;	//   from deleteFirst to deleteLast
+static unsigned int deleteLast;
+
+unsigned char MAGIC[] = {0x55, 0xAB};	// special value to check for EEPROM initialization (changes with the log format)
+static const unsigned char OLDMAGIC[] = {0x55, 0xAA};	// original log of sequences without extent headers
+
+static unsigned int Dir_Read (unsigned int seq, unsigned int *segs) {
+	// Returns the start address of sequence 'seq' and its segment count in 'segs'
+	unsigned char buffer[DIRENTRY];
+	
+	EEPROM_Read(dirAdd+DIRHEADER+(seq*DIRENTRY), buffer, DIRENTRY);
+	*segs = ((unsigned int)buffer[2] << 8) | buffer[3];
+	return ((unsigned int)buffer[0] << 8) | buffer[1];
+}
+
+static void Dir_Write (unsigned int seq, unsigned int add, unsigned int segs) {
+	// Updates directory entry 'seq' with the sequence address 'add' and segment count 'segs'
+	unsigned char buffer[DIRENTRY];
+	
+	buffer[0] = add >> 8; buffer[1] = add;
+	buffer[2] = segs >> 8; buffer[3] = segs;
+	EEPROM_Write(dirAdd+DIRHEADER+(seq*DIRENTRY), buffer, DIRENTRY);
+}
+
+static void Dir_Move (unsigned int src, unsigned int dest, unsigned int total) {
+	// Copies 'total' directory entries from entry 'src' down to entry 'dest' (dest <= src).
+	unsigned char buffer[DIRCHUNK*DIRENTRY];
+	unsigned int size;
+	
+	while (total > 0) {
+		size = total; if (size > DIRCHUNK) size = DIRCHUNK;
+		EEPROM_Read(dirAdd+DIRHEADER+(src*DIRENTRY), buffer, size*DIRENTRY);
+		EEPROM_Write(dirAdd+DIRHEADER+(dest*DIRENTRY), buffer, size*DIRENTRY);
+		src += size; dest += size; total -= size;
+	}	
+}
+
+static void Dir_SetValid (BOOL valid) {
+	// Writes the directory header.  The header is marked invalid while the sequences and
+	// directory are being changed so an interrupted update is detected by Seq_Init.
+	unsigned char buffer[7];
+	
+	buffer[0] = valid ? DIRVALID : 0x00;
+	buffer[1] = seqTotal >> 8; buffer[2] = seqTotal;
+	buffer[3] = logEnd >> 8; buffer[4] = logEnd;
+	buffer[5] = garbage >> 8; buffer[6] = garbage;
+	EEPROM_Write(dirAdd, buffer, 7);
+	dirValid = valid;
+}
+
+static void Dir_Invalidate (void) {
+	// Called before the sequence data is changed
+	if (dirValid) Dir_SetValid(FALSE);
+	segmentValid = FALSE;
+}
+
+static void MoveBytes (unsigned int srcAdd, unsigned int destAdd, unsigned int total);
+static void Slide (unsigned int srcAdd, unsigned int destAdd, unsigned int total, unsigned int done);
+static void Migrate (unsigned char journal[]);
+
+static void AddGarbage (unsigned int bytes) {
+	// Account for 'bytes' of dead log data.  Compaction restarts from the beginning
+	// of the log since the garbage may lie below the compacted area.
+	garbage += bytes;
+	compactAdd = 0;
+}
+
+static unsigned int Tag (unsigned int seq) {
+	// Returns the tag in the extent header of sequence 'seq'
+	unsigned char buffer[2];
+	unsigned int segs;
+	
+	EEPROM_Read(Dir_Read(seq, &segs)-EXTHEADER+1, buffer, 2);
+	return ((unsigned int)buffer[0] << 8) | buffer[1];
+}
+
+static unsigned int NextTag (void) {
+	// Returns a tag that orders after every sequence.  When the tags run out they are
+	// renumbered from 0 in sequence order.  Each new tag is no larger than the one it
+	// replaces so the order holds even if this is interrupted.
+	unsigned char buffer[2];
+	unsigned int seq, segs, tag;
+	
+	if (seqTotal == 0) return 0;
+	tag = Tag(seqTotal-1);
+	if (tag == 0xFFFF) {
+		for (seq=0; seq<seqTotal; seq++) {
+			buffer[0] = seq >> 8; buffer[1] = seq;
+			EEPROM_Write(Dir_Read(seq, &segs)-EXTHEADER+1, buffer, 2);
+		}
+		tag = seqTotal-1;
+	}
+	return tag+1;
+}
+
+static void Fill (unsigned int add, unsigned int size) {
+	// Marks 'size' bytes of garbage at 'add' as a hole, or as padding if it's too short
+	unsigned char buffer[EXTHEADER];
+	
+	if (size >= EXTHEADER) {
+		buffer[0] = HOLE; buffer[1] = size >> 8; buffer[2] = size;
+		EEPROM_Write(add, buffer, EXTHEADER);
+	} else {
+		while (size > 0) {
+			EEPROM_WriteChar(add++, PAD); size--;
+		}
+	}	
+}
+
+static void Dir_Insert (unsigned int tag, unsigned int add, unsigned int segs) {
+	// Enters the live extent at 'add' into the directory in tag order.  An extent with
+	// the same tag as one already entered is the later copy of a moved sequence and 
+	// replaces it.  The copy that loses is marked dead.
+	unsigned int seq, oldAdd, oldSegs, oldTag;
+	
+	seq = seqTotal;
+	while (seq > 0) {
+		oldTag = Tag(seq-1);
+		if (oldTag < tag) break;
+		seq--;
+		if (oldTag == tag) {
+			oldAdd = Dir_Read(seq, &oldSegs);
+			EEPROM_WriteChar(oldAdd-EXTHEADER, DEAD);
+			garbage += oldSegs*BYTESPERSEQ+EXTHEADER+1;
+			Dir_Write(seq, add, segs);
+			return;
+		}
+	}
+	if (seqTotal >= EEMAX) {
+		// no room in the directory
+		EEPROM_WriteChar(add-EXTHEADER, DEAD);
+		garbage += segs*BYTESPERSEQ+EXTHEADER+1;
+		return;
+	}
+	if (seq < seqTotal) {
+		MoveBytes(dirAdd+DIRHEADER+(seq*DIRENTRY), dirAdd+DIRHEADER+((seq+1)*DIRENTRY), (seqTotal-seq)*DIRENTRY);
+	}
+	Dir_Write(seq, add, segs);
+	seqTotal++;
+}
+
+void Seq_RebuildIndex (void) {
+	// Rebuilds the sequence directory by walking the extents in the log.  Dead extents,
+	// holes, and padding are garbage and the live extents are entered in tag order.
+	// The walk ends at the log terminator, at anything that isn't an extent, or at an
+	// extent that would run into the directory.  Anything after the last extent is free.
+	unsigned char skip[BYTESPERSEQ-1];
+	unsigned int add = 0, end = 0, endGarbage = 0;
+	unsigned int start, size, tag;
+	unsigned char mark;
+	
+	Clock_Boost();
+	Dir_Invalidate();
+	seqTotal = 0; garbage = 0;
+	while (add+EXTHEADER < dirAdd) {
+		EEPROM_OpenRead(add);
+		mark = EEPROM_ReadNext();
+		if (mark == PAD) {
+			EEPROM_CloseRead();
+			add++; garbage++;
+			continue;
+		}
+		if ((mark != LIVE) && (mark != DEAD) && (mark != HOLE)) {
+			EEPROM_CloseRead();
+			break;										// end of the log
+		}	
+		tag = (unsigned int)EEPROM_ReadNext() << 8;
+		tag |= EEPROM_ReadNext();
+		if (mark == HOLE) {
+			EEPROM_CloseRead();
+			if ((tag < EXTHEADER) || (tag >= dirAdd-add)) break;
+			add += tag; garbage += tag;
+			continue;
+		}
+		start = add+EXTHEADER; size = 0;
+		while ((start+size < dirAdd) && (EEPROM_ReadNext() != ENDMARK)) {
+			EEPROM_ReadBlock(skip, BYTESPERSEQ-1);		// rest of the segment
+			size += BYTESPERSEQ;
+		}
+		EEPROM_CloseRead();
+		if ((size == 0) || (start+size+1 >= dirAdd)) break;
+		add = start+size+1;
+		if ((mark == LIVE) && deleting && (tag >= deleteFirst) && (tag <= deleteLast)) {
+			EEPROM_WriteChar(start-EXTHEADER, DEAD);	// finish the deletion
+			mark = DEAD;
+		}
+		if (mark == LIVE) Dir_Insert(tag, start, size/BYTESPERSEQ);
+		else garbage += size+EXTHEADER+1;
+		end = add; endGarbage = garbage;
+	}
+	logEnd = end; garbage = endGarbage; compactAdd = 0;
+	if (EEPROM_ReadChar(logEnd) != ENDMARK) EEPROM_WriteChar(logEnd, ENDMARK);
+	Dir_SetValid(TRUE);
+	Clock_Release();
+}
 
-unsigned char MAGIC[] = {0x55, 0xAA};	// special value to check for EEPROM initialization
+static BOOL Dir_Current (void) {
+	// Returns TRUE iff the directory header is valid and the log end points at the
+	// terminating markers of the sequence data.
+	unsigned char buffer[7];
+	
+	EEPROM_Read(dirAdd, buffer, 7);
+	seqTotal = ((unsigned int)buffer[1] << 8) | buffer[2];
+	logEnd = ((unsigned int)buffer[3] << 8) | buffer[4];
+	garbage = ((unsigned int)buffer[5] << 8) | buffer[6];
+	if ((buffer[0] != DIRVALID) || (seqTotal > EEMAX) || (logEnd >= dirAdd)) return FALSE;
+	if (logEnd == 0) return (seqTotal == 0) && (EEPROM_ReadChar(0) == ENDMARK);
+	EEPROM_Read(logEnd-1, buffer, 2);
+	return (buffer[0] == ENDMARK) && (buffer[1] == ENDMARK);	
+}
 
 void Seq_Init (void) {
 	// Initializes the sequence buffers, points to the first sequence (0), and verifies that EEPROM is
 	// present and how many sequences are stored there.
-	unsigned char buffer[2];
+	unsigned char buffer[9];
 	unsigned int lastAdd;
 	
 	EEPROM_Init();
 	activeSeq = 0; activeIndex = 0;
+	seqTotal = 0; dirValid = TRUE; segmentValid = FALSE;
+	compactAdd = 0;
 	EEPROMPresent = FALSE;
 	if (EEPROM_Present()) {
 		// Check if EEPROM needs initialization
 		lastAdd = EEPROM_GetSize() - 2;
+		dirAdd = EEPROM_GetSize() - DIRSIZE;
 		EEPROMPresent = TRUE;
 		EEPROM_Read(lastAdd, buffer, 2);
-		if ((buffer[0] != MAGIC[0]) || (buffer[1] != MAGIC[1])) {
+		if ((buffer[0] == OLDMAGIC[0]) && (buffer[1] == OLDMAGIC[1])) {
+			// convert the sequences stored by the original firmware
+			EEPROM_Read(dirAdd+JOURNAL, buffer, 9);
+			Migrate(buffer);
+			EEPROM_Write(lastAdd, MAGIC, 2);
+			EEPROM_WriteChar(dirAdd+JOURNAL, 0);
+		} else if ((buffer[0] != MAGIC[0]) || (buffer[1] != MAGIC[1])) {
 			Seq_DeleteAll();					// erase all sequences
 			EEPROM_Write(lastAdd, MAGIC, 2);	// initialize EEPROM
+		} else {
+			EEPROM_Read(dirAdd+JOURNAL, buffer, 9);
+			if (buffer[0] == SLIDING) {
+				// finish the slide that was cut short
+				Dir_Invalidate();
+				Slide(((unsigned int)buffer[1] << 8) | buffer[2], ((unsigned int)buffer[3] << 8) | buffer[4],
+					  ((unsigned int)buffer[5] << 8) | buffer[6], ((unsigned int)buffer[7] << 8) | buffer[8]);
+			} else if (buffer[0] == DELETING) {
+				// the rebuild finishes the deletion that was cut short
+				deleting = TRUE;
+				deleteFirst = ((unsigned int)buffer[1] << 8) | buffer[2];
+				deleteLast = ((unsigned int)buffer[3] << 8) | buffer[4];
+				Dir_Invalidate();
+			}
+			if (!Dir_Current()) Seq_RebuildIndex();	// directory is stale
+			if (deleting) {
+				EEPROM_WriteChar(dirAdd+JOURNAL, 0);
+				deleting = FALSE;
+			}
 		}
 	}	
 }
 
-static unsigned int SkipToEnd (unsigned int add) {
-	// Moves to the end of the active sequence
-	unsigned char eechar;
-	
-	eechar = EEPROM_ReadChar(add);
-	while (eechar != ENDMARK) {
-		add += BYTESPERSEQ;
-		eechar = EEPROM_ReadChar(add);
-	}	
-	return add;
-}
-
 FindResult Seq_Find (unsigned int seqNumber) {
-	unsigned int add = 0;
-	unsigned int seq;
+	unsigned int segs;
 	
 	// Check if any sequences are defined
-	if (EEPROM_ReadChar(0) == ENDMARK) {
+	if (seqTotal == 0) {
 		lastIndex = 0; lastSeq = 0; 
 		return NO_SEQUENCES;
 	}	
 	
-	// Look for sequence
-	for (seq=0; seq<seqNumber; seq++) {
-		add = SkipToEnd(add);
-		
-		if (EEPROM_ReadChar(add+1) == ENDMARK) {
-			// update the last sequence variables
-			lastSeq = seq; 
-			lastIndex = add;
-			if (seq == 0) return AT_LAST_SEQUENCE;
-			
-			// find the start of the sequence
-			add--;
-			while (EEPROM_ReadChar(add) != ENDMARK) add -= BYTESPERSEQ;
-			lastIndex = add+1;
-			return AT_LAST_SEQUENCE;
-		}
-		add++;	// skip end of sequence marker	
+	// Look up the sequence in the directory
+	if (seqNumber >= seqTotal) {
+		// update the last sequence variables
+		lastSeq = seqTotal-1;
+		lastIndex = Dir_Read(lastSeq, &segs);
+		return AT_LAST_SEQUENCE;
 	}
 	activeSeq = seqNumber;
-	activeIndex = add;
+	activeIndex = Dir_Read(seqNumber, &segs);
+	segmentValid = FALSE;
 	return FIND_OK;
 }
 
 unsigned int Seq_CopyToBuffer (unsigned int seqNumber, unsigned char buffer[]) {
-	unsigned int seqStart, seqEnd, i;
+	unsigned int segs;
 	
 	if (Seq_Find(seqNumber) == FIND_OK) {
-		seqStart = activeIndex; seqEnd = SkipToEnd(seqStart);
-		i = 0;
-		while (seqStart < seqEnd) buffer[i++] = EEPROM_ReadChar(seqStart++);
-		return i;
+		Dir_Read(seqNumber, &segs);
+		EEPROM_Read(activeIndex, buffer, segs*BYTESPERSEQ);
+		return segs*BYTESPERSEQ;
 	}
 	return 0;	
 }	
@@ -108,17 +374,33 @@ unsigned int Seq_GetActive (void) {
 	return activeSeq;
 }
 
+static void Seq_Load (void) {
+	// Reads the active segment and the following byte in one EEPROM burst.  The look-ahead 
+	// byte tells Seq_Next whether this is the last segment of the sequence.
+	if (!segmentValid) {
+		EEPROM_Read(activeIndex, (unsigned char *)&segment, sizeof(segment));
+		segmentValid = TRUE;
+	}	
+}
+
+const Segment * Seq_GetSegment (void) {
+	Seq_Load();
+	return &segment;
+}
+
 BOOL Seq_Next (BOOL repeat) {
-	if (EEPROM_ReadChar(activeIndex+BYTESPERSEQ) != ENDMARK) {
+	Seq_Load();
+	if (segment.next != ENDMARK) {
 		activeIndex += BYTESPERSEQ;
+		segmentValid = FALSE;
 	} else {
 		if (repeat) {
 			// repeat the active sequence
 			Seq_Find(activeSeq);
 		} else {
 			// advance to the next sequence	
-			if (EEPROM_ReadChar(activeIndex+(BYTESPERSEQ+1)) == ENDMARK) return FALSE;
-			activeIndex += BYTESPERSEQ+1; activeSeq++;
+			if (activeSeq+1 >= seqTotal) return FALSE;
+			Seq_Find(activeSeq+1);
 		}		
 	}
 	return TRUE;	
@@ -127,99 +409,324 @@ BOOL Seq_Next (BOOL repeat) {
 unsigned char Seq_GetPWM (unsigned char ch) {
 	// Gets the PWM level for the active sequence associated with channel 'ch' where ch ranges from 0 to 3.
 	// If no sequence is active, sequence 0 is accessed.
-	return EEPROM_ReadChar(activeIndex+ch+2);
+	Seq_Load();
+	return segment.pwm[ch];
 }
 
 unsigned char Seq_GetHold (void) {
 	// Gets the hold time for the active sequence. If no sequence is active, sequence 0 is accessed.
-	return EEPROM_ReadChar(activeIndex+1);
+	Seq_Load();
+	return segment.hold;
 }	
 
 unsigned char Seq_GetFade (void) {
 	// Gets the fade rate for the active sequence. If no sequence is active, sequence 0 is accessed.
-	return EEPROM_ReadChar(activeIndex);
+	Seq_Load();
+	return segment.fade;
 }
 
-static void MoveBlock (unsigned int srcAdd, unsigned int destAdd, unsigned int total) {
-	// Non-overlapping block move
-	unsigned char buffer[64];
-	
-	while (total > sizeof(buffer)) {
-		EEPROM_Read(srcAdd, buffer, sizeof(buffer)); srcAdd += sizeof(buffer);
-		EEPROM_Write(destAdd, buffer, sizeof(buffer)); destAdd += sizeof(buffer);
-		total -= sizeof(buffer);		
-	}
-	if (total > 0) {
-		EEPROM_Read(srcAdd, buffer, total); 
-		EEPROM_Write(destAdd, buffer, total);
-	}	
-}	
-
 static void MoveBytes (unsigned int srcAdd, unsigned int destAdd, unsigned int total) {
 	// Shift a 'total' number of bytes from the srcAdd to the destAdd in EEPROM.  Overlapping
 	// memory areas are handled properly.  Any bytes moved beyond the end of memory are lost.
-	unsigned int overlap = destAdd - srcAdd;
-	if (destAdd > srcAdd && total > overlap) {
-		MoveBlock(destAdd, destAdd+overlap, total - overlap);
-		total = overlap;
+	unsigned char buffer[64];
+	unsigned int size;
+	
+	if (destAdd > srcAdd) {
+		// moving up -- copy from the top down so bytes are read before they are overwritten
+		while (total > 0) {
+			size = total; if (size > sizeof(buffer)) size = sizeof(buffer);
+			total -= size;
+			EEPROM_Read(srcAdd+total, buffer, size);
+			EEPROM_Write(destAdd+total, buffer, size);
+		}
+	} else {
+		// moving down -- copy from the bottom up
+		while (total > 0) {
+			size = total; if (size > sizeof(buffer)) size = sizeof(buffer);
+			EEPROM_Read(srcAdd, buffer, size); srcAdd += size;
+			EEPROM_Write(destAdd, buffer, size); destAdd += size;
+			total -= size;
+		}
 	}	
-	if (total > 0) MoveBlock(srcAdd, destAdd, total);
 }		
 
-BOOL Seq_AddTo (unsigned int seqNumber, unsigned char rgbw[], unsigned char hold, unsigned char fade) {
-	// Adds to the sequence 'seqNumber'.  If the sequence doesn't exist or isn't writeable, a FALSE is returned.
-	unsigned int sadd, eadd, size;
+static void Slide (unsigned int srcAdd, unsigned int destAdd, unsigned int total, unsigned int done) {
+	// Slides 'total' bytes at 'srcAdd' down to 'destAdd' starting 'done' bytes in.  No
+	// piece is longer than the distance moved so a piece never overwrites its own source
+	// and can be moved again if the power is cut.  The journal holds the piece being 
+	// moved so Seq_Init can finish the slide.  The bytes left behind become a hole once
+	// the journal shows that every piece has moved.
+	unsigned char buffer[9];
+	unsigned int size, gap = srcAdd-destAdd;
+	
+	buffer[0] = SLIDING;
+	buffer[1] = srcAdd >> 8; buffer[2] = srcAdd;
+	buffer[3] = destAdd >> 8; buffer[4] = destAdd;
+	buffer[5] = total >> 8; buffer[6] = total;
+	for (;;) {
+		buffer[7] = done >> 8; buffer[8] = done;
+		EEPROM_Write(dirAdd+JOURNAL, buffer, 9);
+		if (done >= total) break;
+		size = total-done; if (size > gap) size = gap;
+		MoveBytes(srcAdd+done, destAdd+done, size);
+		done += size;
+	}
+	Fill(destAdd+total, gap);
+	EEPROM_WriteChar(dirAdd+JOURNAL, 0);
+}
+
+static void Migrating (unsigned int count, unsigned int left, unsigned int done) {
+	// Journals how far the conversion of the original log has got.  The last byte checks
+	// the record since the journal may hold sequence data from the original log.
 	unsigned char buffer[8];
 	
-	if (EEPROMPresent) {
-		// set up the sequence contents
-		buffer[0] = fade; buffer[1] = hold;
-		buffer[2] = rgbw[0]; buffer[3] = rgbw[1];
-		buffer[4] = rgbw[2]; buffer[5] = rgbw[3];
-		buffer[6] = ENDMARK; size = BYTESPERSEQ+1;
-		
-		// make room for sequence
+	buffer[0] = MIGRATING;
+	buffer[1] = count >> 8; buffer[2] = count;
+	buffer[3] = left >> 8; buffer[4] = left;
+	buffer[5] = done >> 8; buffer[6] = done;
+	buffer[7] = ~(buffer[1] + buffer[2] + buffer[3] + buffer[4] + buffer[5] + buffer[6]);
+	EEPROM_Write(dirAdd+JOURNAL, buffer, 8);
+}
+
+static void Migrate (unsigned char journal[]) {
+	// Converts the original log, where each sequence is just its segments and an ENDMARK,
+	// to extents.  The directory is written first with the new addresses.  The sequences 
+	// are then moved up from the top down to make room for their extent headers so each
+	// one moves into space that is already free.  No piece is longer than the distance 
+	// moved and the journal holds the piece being moved, so 'journal' can restart a 
+	// conversion that was cut short.  Sequences that no longer fit below the directory 
+	// are dropped.
+	unsigned char buffer[DIRCHUNK*DIRENTRY];
+	unsigned char skip[BYTESPERSEQ-1];
+	unsigned int add = 0, count, left, done = 0;
+	unsigned int seq, segs, size, gap, piece;
+	unsigned char entries = 0;
+	
+	Clock_Boost();
+	Dir_Invalidate();
+	count = ((unsigned int)journal[1] << 8) | journal[2];
+	left = ((unsigned int)journal[3] << 8) | journal[4];
+	if ((journal[0] == MIGRATING) && (count <= EEMAX) && (left <= count) &&
+		(journal[7] == (unsigned char)~(journal[1] + journal[2] + journal[3] + journal[4] + journal[5] + journal[6]))) {
+		// carry on from the journal
+		done = ((unsigned int)journal[5] << 8) | journal[6];
+	} else {
+		// walk the original log as one stream and write its directory a chunk at a time
+		EEPROM_WriteChar(dirAdd+JOURNAL, 0);
+		count = 0;
+		for (;;) {
+			EEPROM_OpenRead(add);
+			while ((entries < DIRCHUNK) && (count < EEMAX) && (EEPROM_ReadNext() != ENDMARK)) {
+				size = 0;
+				do {
+					EEPROM_ReadBlock(skip, BYTESPERSEQ-1);	// rest of the segment
+					size += BYTESPERSEQ;
+				} while ((add+size+(count+1)*EXTHEADER+1 < dirAdd) && (EEPROM_ReadNext() != ENDMARK));
+				if (add+size+(count+1)*EXTHEADER+1 >= dirAdd) break;	// no room for the rest
+				seq = add+(count+1)*EXTHEADER;
+				buffer[entries*DIRENTRY] = seq >> 8; buffer[entries*DIRENTRY+1] = seq;
+				buffer[entries*DIRENTRY+2] = size/BYTESPERSEQ >> 8; buffer[entries*DIRENTRY+3] = size/BYTESPERSEQ;
+				add += size+1;
+				entries++; count++;
+			}
+			EEPROM_CloseRead();
+			if (entries > 0) EEPROM_Write(dirAdd+DIRHEADER+((count-entries)*DIRENTRY), buffer, entries*DIRENTRY);
+			if (entries < DIRCHUNK) break;
+			entries = 0;
+		}
+		left = count;
+	}
+	
+	// move each sequence up past the headers of the sequences below it and add its header
+	while (left > 0) {
+		seq = left-1;
+		add = Dir_Read(seq, &segs);
+		size = segs*BYTESPERSEQ+1;
+		gap = (seq+1)*EXTHEADER;
+		for (;;) {
+			Migrating(count, left, done);
+			if (done >= size) break;
+			piece = size-done; if (piece > gap) piece = gap;
+			MoveBytes(add-gap+size-done-piece, add+size-done-piece, piece);
+			done += piece;
+		}
+		buffer[0] = LIVE; buffer[1] = seq >> 8; buffer[2] = seq;
+		EEPROM_Write(add-EXTHEADER, buffer, EXTHEADER);
+		left--; done = 0;
+	}
+	
+	// terminate the converted log
+	if (count == 0) logEnd = 0;
+	else {
+		add = Dir_Read(count-1, &segs);
+		logEnd = add+segs*BYTESPERSEQ+1;
+	}
+	EEPROM_WriteChar(logEnd, ENDMARK);
+	if (logEnd == 0) EEPROM_WriteChar(1, ENDMARK);
+	seqTotal = count; garbage = 0; compactAdd = 0;
+	Dir_SetValid(TRUE);
+	Clock_Release();
+}
+
+static unsigned int Append (unsigned int tag, unsigned int srcAdd, unsigned int size, unsigned char segs[], unsigned int bytes) {
+	// Appends an extent holding 'size' bytes copied from 'srcAdd' followed by 'bytes' from 
+	// 'segs'.  The extent's mark replaces the log terminator after everything else is 
+	// written so an interrupted append leaves the log as it was.  Returns the address of
+	// the extent's first segment.
+	unsigned char buffer[2];
+	unsigned int add = logEnd+EXTHEADER;
+	
+	if (size > 0) MoveBytes(srcAdd, add, size);
+	if (bytes > 0) EEPROM_Write(add+size, segs, bytes);
+	buffer[0] = ENDMARK; buffer[1] = ENDMARK;
+	EEPROM_Write(add+size+bytes, buffer, 2);
+	buffer[0] = tag >> 8; buffer[1] = tag;
+	EEPROM_Write(logEnd+1, buffer, 2);
+	EEPROM_WriteChar(logEnd, LIVE);
+	logEnd = add+size+bytes+1;
+	return add;
+}
+
+BOOL Seq_Compact (void) {
+	// Performs one step of the log compaction by moving the live sequence with the lowest
+	// address at or above compactAdd down to compactAdd.  Returns TRUE while there is more
+	// garbage to reclaim.
+	unsigned char buffer[DIRENTRY];
+	unsigned int seq, size, add;
+	unsigned int bestSeq, bestAdd, bestSegs;
+	
+	if (!EEPROMPresent || (garbage == 0)) return FALSE;
+	
+	// find the lowest live extent that hasn't been compacted
+	Clock_Boost();
+	bestAdd = logEnd; bestSeq = 0; bestSegs = 0;
+	EEPROM_OpenRead(dirAdd+DIRHEADER);
+	for (seq=0; seq<seqTotal; seq++) {
+		EEPROM_ReadBlock(buffer, DIRENTRY);
+		add = (((unsigned int)buffer[0] << 8) | buffer[1]) - EXTHEADER;
+		if ((add >= compactAdd) && (add < bestAdd)) {
+			bestAdd = add; bestSeq = seq;
+			bestSegs = ((unsigned int)buffer[2] << 8) | buffer[3];
+		}	
+	}
+	EEPROM_CloseRead();
+	Clock_Release();
+	
+	if (bestAdd == logEnd) {
+		// everything is compacted -- terminate the log at compactAdd
+		Dir_Invalidate();
+		logEnd = compactAdd; garbage = 0; compactAdd = 0;
+		EEPROM_WriteChar(logEnd, ENDMARK);
+		if (logEnd == 0) EEPROM_WriteChar(1, ENDMARK);
+		Dir_SetValid(TRUE);
+		return FALSE;
+	}
+	
+	// slide the extent down over any garbage
+	size = bestSegs*BYTESPERSEQ+EXTHEADER+1;
+	if (bestAdd != compactAdd) {
+		Dir_Invalidate();
+		Slide(bestAdd, compactAdd, size, 0);
+		Dir_Write(bestSeq, compactAdd+EXTHEADER, bestSegs);
+		Dir_SetValid(TRUE);
+	}
+	compactAdd += size;
+	return TRUE;
+}
+
+static BOOL Seq_Reserve (unsigned int bytes) {
+	// Returns TRUE iff 'bytes' plus the log terminator fit below the directory.  The
+	// log is compacted if that will make enough room.
+	if (logEnd+bytes+1 < dirAdd) return TRUE;
+	if (logEnd+bytes+1 >= dirAdd+garbage) return FALSE;
+	while (Seq_Compact());
+	return TRUE;
+}
+
+BOOL Seq_AddToMulti (unsigned int seqNumber, unsigned char segs[], unsigned int blocks) {
+	// Adds 'blocks' segments to the sequence 'seqNumber'.  Each segment in 'segs' is stored as fade,
+	// hold, and four PWM values.  A new sequence is appended to the log if 'seqNumber' doesn't exist.
+	// If the sequence isn't writeable, a FALSE is returned.
+	unsigned int sadd, add, count, size, bytes;
+	unsigned char buffer[2];
+	
+	if (EEPROMPresent && (blocks > 0)) {
+		bytes = blocks*BYTESPERSEQ;
 		if (Seq_Find(seqNumber) == FIND_OK) {
-			// make room for new sequence data
-			sadd = SkipToEnd(activeIndex);
-			Seq_Find(EEMAX);									// move to very last sequence
-			if (lastIndex > (EEPROM_GetSize() - 256)) return FALSE;
-			eadd = SkipToEnd(lastIndex);
-			MoveBytes(sadd, sadd+BYTESPERSEQ, eadd-sadd+2);		// make room for new addition
+			// make sure there is room for the sequence at the end of the log
+			Dir_Read(seqNumber, &count);
+			size = count*BYTESPERSEQ;
+			if (!Seq_Reserve(size+bytes+EXTHEADER+1)) return FALSE;
+			sadd = Dir_Read(seqNumber, &count);			// compaction may have moved it
+			Dir_Invalidate();
+			if ((sadd+size+1 == logEnd) && ((logEnd % PAGESIZE) != 0)) {
+				// sequence is at the end of the log -- extend it in place.  The two bytes
+				// that replace its end marker and the log terminator are in one page and
+				// are written last.
+				if (compactAdd > sadd) compactAdd += bytes;
+				EEPROM_Write(sadd+size+2, &segs[2], bytes-2);
+				buffer[0] = ENDMARK; buffer[1] = ENDMARK;
+				EEPROM_Write(sadd+size+bytes, buffer, 2);
+				EEPROM_Write(sadd+size, segs, 2);
+				logEnd += bytes;
+			} else {
+				// move the sequence to the end of the log and then kill the old copy
+				add = Append(Tag(seqNumber), sadd, size, segs, bytes);
+				EEPROM_WriteChar(sadd-EXTHEADER, DEAD);
+				AddGarbage(size+EXTHEADER+1);
+				sadd = add;
+			}	
+			Dir_Write(seqNumber, sadd, count+blocks);
 		} else {
-			// add data to the end of all the sequences
-			sadd = SkipToEnd(lastIndex);
-			if (sadd != 0) sadd++;
-			buffer[7] = ENDMARK; size++;
+			// add a new sequence to the end of the log
+			if ((seqTotal >= EEMAX) || !Seq_Reserve(bytes+EXTHEADER+1)) return FALSE;
+			Dir_Invalidate();
+			sadd = Append(NextTag(), 0, 0, segs, bytes);
+			Dir_Write(seqTotal++, sadd, blocks);
+			activeSeq = seqTotal-1; activeIndex = sadd;
 		}
-		
-		// write the new sequence addition
-		EEPROM_Write(sadd, buffer, size);
+		Dir_SetValid(TRUE);
 		return TRUE;
 	}
 	return FALSE;	
 }
 
+BOOL Seq_AddTo (unsigned int seqNumber, unsigned char rgbw[], unsigned char hold, unsigned char fade) {
+	// Adds to the sequence 'seqNumber'.  If the sequence doesn't exist or isn't writeable, a FALSE is returned.
+	unsigned char buffer[BYTESPERSEQ];
+	
+	// set up the sequence contents
+	buffer[0] = fade; buffer[1] = hold;
+	buffer[2] = rgbw[0]; buffer[3] = rgbw[1];
+	buffer[4] = rgbw[2]; buffer[5] = rgbw[3];
+	return Seq_AddToMulti(seqNumber, buffer, 1);
+}
+
 BOOL Seq_Delete_Range (unsigned int seqStart, unsigned int seqEnd) {
 	// Deletes the range of sequences from 'seqStart' to 'seqEnd'.  If the sequence doesn't exist or isn't 
-	// writeable, a FALSE is returned.
-	unsigned int startAdd, endAdd, lastAdd;
+	// writeable, a FALSE is returned.  The sequence data becomes garbage in the log.
+	unsigned char buffer[5];
+	unsigned int seq, segs, tag;
 	
 	if ((seqEnd >= seqStart) && EEPROMPresent) {
 		if (Seq_Find(seqStart) == FIND_OK) {
-			startAdd = activeIndex;
-			if (Seq_Find(seqEnd) == FIND_OK) {
-				// need to move all following sequences to startAdd
-				endAdd = SkipToEnd(activeIndex);
-				Seq_Find(EEMAX); lastAdd = SkipToEnd(lastIndex);	// go to last address in sequence
-				if (lastAdd > endAdd) {
-					MoveBytes(endAdd+1, startAdd, lastAdd-endAdd+1);
-					return TRUE;
-				}	
-			} 
-			// deleting everything from StartAdd to end
-			// mark end of all sequences at startAdd
-			EEPROM_WriteChar(startAdd, ENDMARK);
+			if (seqEnd >= seqTotal) seqEnd = seqTotal-1;
+			Dir_Invalidate();
+			
+			// journal the tags so Seq_Init can finish an interrupted deletion
+			buffer[0] = DELETING;
+			tag = Tag(seqStart); buffer[1] = tag >> 8; buffer[2] = tag;
+			tag = Tag(seqEnd); buffer[3] = tag >> 8; buffer[4] = tag;
+			EEPROM_Write(dirAdd+JOURNAL, buffer, 5);
+			for (seq=seqStart; seq<=seqEnd; seq++) {
+				EEPROM_WriteChar(Dir_Read(seq, &segs)-EXTHEADER, DEAD);
+				AddGarbage(segs*BYTESPERSEQ+EXTHEADER+1);
+			}	
+			Dir_Move(seqEnd+1, seqStart, seqTotal-seqEnd-1);
+			seqTotal -= seqEnd-seqStart+1;
+			if (seqTotal == 0) return Seq_DeleteAll();
+			Dir_SetValid(TRUE);
+			EEPROM_WriteChar(dirAdd+JOURNAL, 0);
 			return TRUE;
 		}		
 	}
@@ -228,8 +735,12 @@ BOOL Seq_Delete_Range (unsigned int seqStart, unsigned int seqEnd) {
 
 BOOL Seq_DeleteAll (void) {
 	// Just write two markers at the beginning of EEPROM
+	Dir_Invalidate();
 	EEPROM_WriteChar(0, ENDMARK);
 	EEPROM_WriteChar(1, ENDMARK);
+	EEPROM_WriteChar(dirAdd+JOURNAL, 0);
+	seqTotal = 0; logEnd = 0; garbage = 0; compactAdd = 0;
+	Dir_SetValid(TRUE);
 	return TRUE;	
 }		
 
@@ -241,11 +752,12 @@ BOOL Seq_New (unsigned char rgbw[], unsigned char hold, unsigned char fade) {
 	return Seq_AddTo(EEMAX, rgbw, hold, fade);
 }
 
+BOOL Seq_New_Multi (unsigned char segs[], unsigned int blocks) {
+	// Creates a new sequence in EEPROM with 'blocks' segments.  The created sequence becomes active.
+	return Seq_AddToMulti(EEMAX, segs, blocks);
+}
+
 unsigned int Seq_Count (void) {
 	// Returns a count of all sequences in EEPROM
-	unsigned int total = 0;
-	
-	if (Seq_Find(EEMAX) != NO_SEQUENCES) total = lastSeq + 1;
-	return total;
-}	
-
+	return seqTotal;
+}
@@ -15,12 +15,25 @@ typedef enum _FindResult {
 	FIND_OK, AT_LAST_SEQUENCE, NO_SEQUENCES
 } FindResult;
 
+// Segment record as stored in EEPROM followed by a look-ahead byte
+typedef struct _Segment {
+	unsigned char fade;
+	unsigned char hold;
+	unsigned char pwm[4];
+	unsigned char next;				// following byte -- ENDMARK flags the end of a sequence
+} Segment;
+
 extern const unsigned char Sequences[];
 
 extern void Seq_Init (void);
 // Initializes the sequence buffers, points to the first sequence (0), and verifies that EEPROM is
 // present and how many sequences are stored there.
 
+extern void Seq_RebuildIndex (void);
+// Rebuilds the sequence directory in EEPROM by scanning the log of stored sequences.  This is
+// done automatically by Seq_Init if the directory is stale, for example after power was lost
+// while a sequence was being changed.
+
 extern FindResult Seq_Find (unsigned int seqNumber);
 // Find the sequence 'seqNumber'.  As a convention, sequences in Flash are numbered 0 to 255.  Sequences
 // stored in EEPROM are numbered from 256 to 65535.  AT_LEAST_SEQUENCE is returned if the sequence 
@@ -39,6 +52,10 @@ extern BOOL Seq_Next (BOOL repeat);
 // repeated; otherwise, the next sequence is activated once at the end of the current sequence. 
 // FALSE is returned if the end of all the sequences is reached.
 
+extern const Segment * Seq_GetSegment (void);
+// Returns the active segment.  The whole segment is read from EEPROM in one transfer and
+// cached until the active segment changes.
+
 extern unsigned char Seq_GetPWM (unsigned char ch);
 // Gets the PWM level for the active sequence associated with channel 'ch' where ch ranges from 0 to 3.
 // If no sequence is active, sequence 0 is accessed.
@@ -55,8 +72,9 @@ extern BOOL Seq_New (unsigned char rgbw[], unsigned char hold, unsigned char fad
 // initialized. The created or overwritten sequence becomes active.  Flash sequences
 // cannot be altered with this function.
 
-//extern BOOL Seq_New_Multi (unsigned char rgbw[], unsigned char hold[], unsigned char fade[], unsigned char blocks);
-// Creates a new sequence in EEPROM with "blocks" segments.  Sequences stored in EEPROM are 
+extern BOOL Seq_New_Multi (unsigned char segs[], unsigned int blocks);
+// Creates a new sequence in EEPROM with "blocks" segments.  Each segment in 'segs' is 
+// stored as fade, hold, and four PWM values (BYTESPERSEQ bytes).  Sequences stored in EEPROM are 
 // numbered from EESTART to EEMAX. A TRUE is returned once the new sequence has been created and 
 // initialized. The created or overwritten sequence becomes active.  Flash sequences
 // cannot be altered with this function.
@@ -64,10 +82,10 @@ extern BOOL Seq_New (unsigned char rgbw[], unsigned char hold, unsigned char fad
 extern BOOL Seq_AddTo (unsigned int seqNumber, unsigned char rgbw[], unsigned char hold, unsigned char fade);
 // Adds to the sequence 'seqNumber'.  If the sequence doesn't exist or isn't writeable, a FALSE is returned.
 
-//extern BOOL Seq_AddToMulti (unsigned int seqNumber, unsigned char rgbw[], unsigned char hold[], 
-//							unsigned char fade[], unsigned char blocks);
-// Adds 'blocks' segments to the sequence 'seqNumber'.  If the sequence doesn't exist or isn't writeable, 
-// a FALSE is returned.  Up to 13 segments can be added at one time.
+extern BOOL Seq_AddToMulti (unsigned int seqNumber, unsigned char segs[], unsigned int blocks);
+// Adds 'blocks' segments to the sequence 'seqNumber' with the same layout as Seq_New_Multi.  Room
+// is made once and the segments are written in page-sized bursts.  If the sequence doesn't exist 
+// or isn't writeable, a FALSE is returned.
 
 extern BOOL Seq_Delete_Range (unsigned int seqStart, unsigned int seqEnd);
 // Deletes the range of sequences from 'seqStart' to 'seqEnd'.  If the sequence doesn't exist or isn't 
@@ -76,6 +94,11 @@ extern BOOL Seq_Delete_Range (unsigned int seqStart, unsigned int seqEnd);
 extern BOOL Seq_DeleteAll (void);
 // Deletes all sequences in EEPROM.  Returns FALSE if sequences couldn't be deleted.
 
+extern BOOL Seq_Compact (void);
+// Reclaims space left in EEPROM by deleted or moved sequences.  Each call does a small
+// part of the work so it can be called repeatedly while the controller is idle.  TRUE
+// is returned while there is more space to reclaim.
+
 extern unsigned int Seq_Count (void);
 // Returns a count of all sequences in EEPROM if 'EEPROM' is TRUE and all sequences defined in FLASH, otherwise
 
@@ -4,10 +4,18 @@
 #include <xc.h>	// Required to interface with delay routines
 
 #ifndef _XTAL_FREQ
- // Unless already defined assume 4MHz system frequency
- // This definition is required to calibrate __delay_us() and __delay_ms()
+ // Unless already defined assume 4MHz system frequency or 32MHz when CLOCK_32MHZ
+ // is defined.  This definition is required to calibrate __delay_us() and __delay_ms()
+ #ifdef CLOCK_32MHZ
+ 	#define _XTAL_FREQ 	32000000			// 8MHz internal oscillator with the x4 PLL
+ #else
  	#define _XTAL_FREQ 	4000000
-	#define IPERIOD		(_XTAL_FREQ/4)		// Instruction clock in Hz
+ #endif
+#endif
+#define IPERIOD		(_XTAL_FREQ/4)		// Instruction clock in Hz
+
+#ifdef CLOCK_32MHZ
+	#define IDLE_FREQ	(_XTAL_FREQ/4)		// x4 PLL off while idle -- one timer prescale step slower
 #endif
 
 #ifndef BOOL
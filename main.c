@@ -16,6 +16,9 @@
 *			Pushbuttons can be used to define the macros (see below) or put the
 *			RGBW hardware into a sleep mode (holding PB2 for 5 secs).  By default,
 *			all the sequences in external EEPROM will be sequentially executed. 
+*			The work is split into run-to-completion tasks (pushbuttons, protocol,
+*			playback, EEPROM maintenance, and night sense) that the scheduler in
+*			\em Scheduler.c runs from the 5mS PWM tick.
 * \author   Michael Griebling
 * \date   	10 Nov 2011
 */ 
@@ -29,7 +32,7 @@
 
 // CONFIG1
 #pragma config FOSC = INTOSC    // Oscillator Selection (INTOSC oscillator: I/O function on CLKIN pin)
-#pragma config WDTE = OFF       // Watchdog Timer Enable (WDT disabled)
+#pragma config WDTE = SWDTEN    // Watchdog Timer Enable (WDT controlled by the SWDTEN bit -- only used to end naps)
 #pragma config PWRTE = OFF      // Power-up Timer Enable (PWRT disabled)
 #pragma config MCLRE = ON       // MCLR Pin Function Select (MCLR/VPP pin function is MCLR)
 #pragma config CP = OFF         // Flash Program Memory Code Protection (Program memory code protection is disabled)
@@ -55,6 +58,8 @@
 #include "MemoryMap.h"
 #include "Macros.h"
 #include "EEPROM.h"
+#include "Scheduler.h"
+#include "Clock.h"
 #include <stdlib.h>
 
 // Temporarily define FLASHCOPY to initialize the external EEPROM with the contents
@@ -69,6 +74,9 @@
 #endif
 
 #define FW_VERSION	(2)
+#define NOXFADE		(0xFF)				// XFADEADD value when crossfading is off
+#define FASTEST		(240)				// fade value for a one tick fade
+#define NAPON		(1)					// NAPADD value when napping is on
 
 // Initial internal EEPROM default contents
 // Default data definitions for internal EEPROM:
@@ -88,21 +96,45 @@ unsigned int activeSequence;			// active sequence to play
 unsigned int maxAddress, minAddress;	// sequence start and end address
 BOOL override;							// override outputs via SBUS
 BOOL playMacros;						// play EEPROM macros if TRUE
+
+static unsigned int playing;			// sequence being played
+static const Segment * seg;				// next segment to queue
+static unsigned char fade;				// fade for the next segment
+static BOOL segReady;					// TRUE while 'seg' is part of 'playing'
+static BOOL dark;						// TRUE once the daytime fade out is queued
+static BOOL play;						// TRUE to let the playback task run
+static BOOL defining;					// TRUE to repeat 'defineSeq' while defining macros
+static unsigned int defineSeq;			// sequence shown while defining macros
+
+static void PlayTask (void);
+static void MaintenanceTask (void);
+
+// Scheduled tasks in the order that they run on each tick
+const Task Tasks[] = {
+	{PushButtons_Scan, 2, 0},			// debounce the pushbuttons every 10mS
+	{SBUS_Process_Command, 1, 0},		// parse received protocol characters
+	{PlayTask, 4, PWM_EVENT},			// refill the PWM ramp queue as each ramp starts
+	{MaintenanceTask, 20, 0},			// write cached EEPROM data and compact sequences
+	{NightSense_UpdateState, TICKSPERMINUTE, 0},	// once a minute
+#ifdef CLOCK_32MHZ
+	{Clock_Task, 1, 0}					// drop to the idle clock when quiet
+#endif
+};
+#define TASKS	(sizeof(Tasks)/sizeof(Task))
 	
 
+// Run the scheduled tasks for one tick
+static BOOL ScanOnce (void) {
+	Sched_Run(FALSE);
+	return PushButtons_Active(BUTTON1|BUTTON2);
+//	return PushButtons_Active(BUTTON2);
+}
+
 // Wait for Sequence to finish playing while also scanning the pushbuttons and 
 // handling any external commands
 BOOL Scan (void) {
-	unsigned int i;
-	
 	do {
-		PushButtons_Scan();			// update pushbutton status
-		for (i=0; i<10; i++) {
-			SBUS_Process_Command();	// handle protocol commands
-			__delay_ms(1);
-		}
-		if (PushButtons_Active(BUTTON1|BUTTON2)) return TRUE;
-//		if (PushButtons_Active(BUTTON2)) return TRUE;
+		if (ScanOnce()) return TRUE;
 	} while (PWM_Busy());
 	return FALSE;	
 }
@@ -130,34 +162,100 @@ void ShowNumber (unsigned int version) {
 }
 
 void ConfirmCommand (void) {
+	Clock_Boost();						// delays are timed at the full clock
 	PWM_Set (0, 0, 255, 0);				// Blue flash
 	__delay_ms(500);	
 	PWM_Set (0, 0, 0, 0);
 	__delay_ms(250);	
+	Clock_Release();
 }
 
 void Error (void) {
+	Clock_Boost();
 	PWM_Set (255, 0, 0, 0);				// Red flash
 	__delay_ms(2000);	
 	PWM_Set (0, 0, 0, 0);
 	__delay_ms(250);	
+	Clock_Release();
 }		
 
-// Play the 'sequence' numbered FLASH or EEPROM sequence.
-void PlaySequence (unsigned int sequence) {
+// Stop the outputs when a sequence is abandoned -- blank them or, when crossfading,
+// leave them showing so the next sequence fades in from there
+static void StopSequence (void) {
+	if (eeprom_read(XFADEADD) == NOXFADE) PWM_Set(0, 0, 0, 0);
+	else PWM_Stop();
+	segReady = FALSE;
+}
+
+// Find the next sequence to play and fetch its first segment.  When a crossfade
+// time is configured (XFADEADD) the first segment fades in from the previous 
+// sequence's levels over that time instead of its own fade.
+static BOOL StartSequence (void) {
+	if (defining) playing = defineSeq;
+	else {
+		if (playMacros) playing = Macros_Read(activeSequence);
+		else playing = activeSequence;
+		if (activeSequence < maxAddress) activeSequence++;
+		else activeSequence = minAddress;
+	}	
+	if (Seq_Find(playing) != FIND_OK) {
+		PWM_Ramp (255, 0, 0, 0, FASTEST, 45);	// Red flash for a missing sequence
+		return FALSE;
+	}	 	
+	seg = Seq_GetSegment();
+	fade = eeprom_read(XFADEADD);
+	if (fade == NOXFADE) fade = seg->fade;
+	segReady = TRUE;
+	return TRUE;
+}	
+
+// Playback task -- queues the next segment whenever the PWM has room.  Each
+// segment is queued while the previous one is still playing and the following 
+// segment is fetched during its fade so there is no gap between segments or
+// sequences.  A pushbutton event stops the sequence until it has been handled.
+static void PlayTask (void) {
 	BOOL ok;
 	
-	if (Seq_Find(sequence) != FIND_OK) {
-		Error(); Scan(); return;
-	}	 	
-	do {
-		PWM_Ramp (Seq_GetPWM(0), Seq_GetPWM(1), Seq_GetPWM(2), Seq_GetPWM(3), Seq_GetFade(), Seq_GetHold());
-		if (Scan()) {
-			PWM_Set(0, 0, 0, 0);
-			return;         		// handle push buttons
-		}	
-		ok = Seq_Next(NOREPEAT);
-	} while ((Seq_GetActive() == sequence) && ok);
+	if (!play) return;
+	if (override) {
+		segReady = FALSE;			// SBUS owns the outputs -- restart when released
+		return;
+	}	
+	if (PushButtons_Active(BUTTON1|BUTTON2)) {
+		if (segReady) StopSequence();
+		return;
+	}	
+	if (PWM_Full()) return;
+	if (!segReady) {
+		// between sequences -- play the next one at night or fade out during the day
+		if (!defining && !NightSense_IsNight()) {
+			if (!dark) dark = PWM_Ramp (0, 0, 0, 0, 1, 0);
+			return;
+		}
+		dark = FALSE;
+		if (!StartSequence()) return;
+	}	
+	PWM_Ramp (seg->pwm[CH1], seg->pwm[CH2], seg->pwm[CH3], seg->pwm[CH4], fade, seg->hold);
+	ok = Seq_Next(NOREPEAT);
+	if ((Seq_GetActive() == playing) && ok) {
+		seg = Seq_GetSegment();		// prefetch the next segment
+		fade = seg->fade;
+	} else segReady = FALSE;		// start the next sequence on the next call
+}	
+
+// The CPU can nap between ticks once the daytime fade out has finished and 
+// nothing else is going on, but only if the host has turned napping on since
+// a nap loses the character that wakes it
+static BOOL Idle (void) {
+	return (eeprom_read(NAPADD) == NAPON) && play && dark && !override && !defining && 
+		   !segReady && !PWM_Busy() && SBUS_Idle() && !PushButtons_Active(BUTTON1|BUTTON2);
+}	
+
+// EEPROM maintenance task -- write cached EEPROM data and reclaim sequence 
+// storage during the day
+static void MaintenanceTask (void) {
+	EEPROM_Flush();
+	if (!segReady && !NightSense_IsNight()) Seq_Compact();
 }	
 
 #ifndef FLASHCOPY
@@ -187,33 +285,35 @@ static void InitMode (void) {
 
 
 void DefineEEMacros (void) {
-	unsigned int sequence = 0;
 	unsigned int prevStart;
 
 	PWM_Set (0, 0, 0, 0);	
-	Seq_Find(sequence);
+	defineSeq = 0; 
+	defining = TRUE; segReady = FALSE;	// the playback task repeats 'defineSeq'
 	prevStart = ReadWord(STARTSEQADD);
 	if (prevStart == PLAYMACROS) prevStart = 0;	
 	do {
-		PlaySequence(sequence);
+		Sched_Run(FALSE);
 		if (PushButtons_Pressed(BUTTON1)) {
 			// advance to next sequence	
-			PWM_Set (0, 0, 0, 0);
+			StopSequence();
 			PushButtons_Clear(BUTTON1);
-			sequence++;
-			if (sequence >= Seq_Count()) sequence = 0;
-			Seq_Find(sequence);
+			defineSeq++;
+			if (defineSeq >= Seq_Count()) defineSeq = 0;
 		}
 		if (PushButtons_Pressed(BUTTON2)) {
 			// add sequence to EEPROM	
 			PWM_Set (0, 0, 0, 0);
+			segReady = FALSE;
 			PushButtons_Clear(BUTTON2);
-			if (Macros_Add(sequence)) {
+			if (Macros_Add(defineSeq)) {
 				ConfirmCommand();
 			} else Error();
 		}	
 	} while (!PushButtons_Held(BUTTON2));
 	PushButtons_Clear(BUTTON2);
+	StopSequence();
+	defining = FALSE;
 	
 	if (Macros_Count() != 0) {
 		WriteWord(STARTSEQADD, PLAYMACROS);	 	// enable macro playback
@@ -227,6 +327,7 @@ void DefineEEMacros (void) {
 }
 
 static void DoSleep (void) {
+	EEPROM_Flush();					// finish any cached EEPROM writes
 	while (PWM_Busy());				// wait for PWM to complete
 	PWM_Set(0, 0, 0, 0);
 	__delay_ms(50);
@@ -244,7 +345,6 @@ static void DoSleep (void) {
    	WPUBbits.WPUB5 = 1;	
    		
 	TMR4IE = 0;						// Disable Timer4 interrupts 
-	TMR6IE = 0;						// Disable Timer6 interrupts 
 
     FVRCON = 0;						// Disable voltage reference
     IOCIE = 1;						// Enable I/O interrupts
@@ -264,26 +364,32 @@ static void DoSleep (void) {
 
 #else
 
-extern unsigned char MAGIC[];
-
 void CopyFlashToEEPROM (void) {
-	unsigned char compare;
-	unsigned int i;
+	const unsigned char *segment;
+	unsigned int i, j, segs;
 	
-	// Copies the contents of FLASH in Sequences[] to EEPROM
+	// Copies the sequences in FLASH in Sequences[] to EEPROM
 	if (EEPROM_Present()) {
-		// Write Sequences data to external EEPROM
-		EEPROM_Write(0x0000, (unsigned char *)Sequences, sizeof(Sequences));
-		
-		// Verify the external EEPROM contents
-		for (i=0; i<sizeof(Sequences); i++) {
-			compare = EEPROM_ReadChar(i);
-			if (compare != Sequences[i]) {
-				 Error();
-				 return;	// abort	
-			}	
+		Seq_DeleteAll();
+		for (i=0; Sequences[i] != ENDMARK; i+=segs*BYTESPERSEQ+1) {
+			// Add each sequence through the sequence log
+			for (segs=0; Sequences[i+segs*BYTESPERSEQ] != ENDMARK; segs++);
+			if (!Seq_New_Multi((unsigned char *)&Sequences[i], segs)) {
+				Error();
+				return;		// abort
+			}
+			
+			// Verify the external EEPROM contents
+			Seq_Find(Seq_Count()-1);
+			for (j=0; j<segs*BYTESPERSEQ; j++) {
+				segment = (const unsigned char *)Seq_GetSegment();
+				if (segment[j % BYTESPERSEQ] != Sequences[i+j]) {
+					 Error();
+					 return;	// abort	
+				}
+				if ((j % BYTESPERSEQ) == BYTESPERSEQ-1) Seq_Next(REPEAT);
+			}
 		}
-		EEPROM_Write(EEPROM_GetSize()-2, MAGIC, 2);	// initialize EEPROM magic number
 		
 		// Set up internal EEPROM start address and sequence length
 		WriteWord(STARTSEQADD, 0x0000);			// enable normal playback		
@@ -298,11 +404,7 @@ void CopyFlashToEEPROM (void) {
 
 main() {
 	
-	// Select the internal 4MHz oscillator
-	OSCCONbits.IRCF = 0b1101;		// 4MHz clock select
-	OSCCONbits.SCS = 0b11;			// Internal oscillator
-	OSCCONbits.SPLLEN = 0;			// x4 PLL disabled
-
+	Clock_Init();					// 4MHz or 32MHz internal oscillator
 	SBUS_Init();
 	EEPROM_Init();
 	Macros_Init();
@@ -310,6 +412,9 @@ main() {
 	PushButtons_Init();
 	NightSense_Init();
 	Seq_Init();						// Start out at the first sequence
+	Sched_Init(Tasks, TASKS);
+	play = FALSE; defining = FALSE;
+	segReady = FALSE; dark = FALSE;
 	
 //	opMode = LIGHTING_MODE;	
  	override = FALSE;
@@ -323,6 +428,7 @@ main() {
 
 	// Display the firmware version number
 	ShowNumber(FW_VERSION);
+	play = TRUE;					// start the playback task
 
 	for (;;) {
 //		if (NightSense_IsNight()) {
@@ -379,22 +485,14 @@ main() {
 //		} else {
 //			PWM_Ramp (0, 0, 0, 0, 1, 0);
 //		}
-		if (NightSense_IsNight()) {
-			if (!override) {
-				if (playMacros) PlaySequence(Macros_Read(activeSequence));
-				else PlaySequence(activeSequence);
-				if (activeSequence < maxAddress) activeSequence++;
-				else activeSequence = minAddress;
-			} else {
-				Scan();
-			}
-		} else {
-			if (!override) PWM_Ramp (0, 0, 0, 0, 1, 0);
-			Scan();
-		}
+		Sched_Run(Idle());			// one tick of pushbuttons, protocol, playback, maintenance, and night sense
 
 #ifndef FLASHCOPY		
 		// handle pushbuttons
+		if (PushButtons_Pressed(BUTTON1)) {
+			// skip to the next sequence
+			PushButtons_Clear(BUTTON1);
+		}
 		if (PushButtons_Pressed(BUTTON2)) {
 			// Change operating modes
 			PushButtons_Clear(BUTTON2);
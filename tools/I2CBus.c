@@ -0,0 +1,319 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	I2CBus.c
+* \details  Host bus model test of the MSSP1 hardware I2C driver in \em I2C.c
+*			and the EEPROM layer above it in \em EEPROM.c.  The MSSP1 registers
+*			are modelled as the hardware runs them: an operation started by
+*			setting SEN, RSEN, PEN, RCEN, or ACKEN, or by writing SSP1BUF, keeps
+*			its bit (or R_nW) set for a few register accesses and then sets
+*			SSP1IF.  Starting an operation before the last one has finished is
+*			a write collision and fails the test.
+*
+*			A 24xx256 on the bus checks the protocol: control byte 0xA0 or 0xA1,
+*			two address bytes, page writes that wrap at 64 bytes and are only
+*			written at the stop, NACKs to its control byte during the internal
+*			write cycle, and a NACK from the master before the stop that ends a
+*			read.  Random EEPROM writes and reads are checked against a plain
+*			copy of what the EEPROM should hold.
+*
+*			Build and run on the host for each clock and bus speed:
+*				cc -I. -o I2CBus I2CBus.c
+*				./I2CBus test
+*				cc -I. -DCLOCK_32MHZ -o I2CBus I2CBus.c
+*				./I2CBus test
+*				cc -I. -DCLOCK_32MHZ -DI2C_SPEED=400000UL -o I2CBus I2CBus.c
+*				./I2CBus test
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MSSP_MODEL
+#define I2C_HARDWARE
+#include "../Types.h"
+#include "../I2C.c"
+#include "../EEPROM.c"
+
+#define OPERATIONS	20000				// random EEPROM operations checked
+#define ROMSIZE		(1024*32)			// 24xx256
+#define ROMPAGE		64					// write page
+#define CONTROL		0xA0				// 24xx256 control byte with A2-A0 low
+#define IDLEBUF		0x100				// SSP1BUF bit 8 -- cleared by a driver write
+#define SEN			0x01				// SSP1CON2 operation bits
+#define RSEN		0x02
+#define PEN			0x04
+#define RCEN		0x08
+#define ACKEN		0x10
+#define SEND		0x20				// SSP1BUF written
+
+static int failures;
+
+static void Check (int ok, const char *test, unsigned long detail) {
+	if (!ok) {
+		failures++;
+		if (failures < 20) printf("FAIL: %s (%lu)\n", test, detail);
+	}
+}
+
+// Simulated 24xx256
+typedef enum _Device {
+	FREE, CONTROLBYTE, ADDRHI, ADDRLO, WRITING, READING, IGNORING
+} Device;
+
+static unsigned char rom[ROMSIZE];
+static unsigned char latch[ROMPAGE];	// page buffer written at the stop
+static BOOL latched[ROMPAGE];
+static unsigned int latchCount;			// data bytes in this write
+static Device state;
+static unsigned int pointer;			// address counter
+static BOOL masterAck;					// the master acknowledged the last byte read
+static unsigned int cycle;				// register accesses left in the internal write cycle
+static unsigned int cycles;				// page writes done
+static unsigned long bits;				// bus clocks
+
+static void DeviceStart (void) {
+	// Start or repeated start -- a write that wasn't stopped is dropped
+	Check(!((state == READING) && masterAck), "start without a NACK to end the read", pointer);
+	memset(latched, 0, sizeof(latched));
+	latchCount = 0;
+	state = CONTROLBYTE;
+}
+
+static void DeviceStop (void) {
+	// Stop -- starts the internal write cycle for any latched data
+	unsigned int i;
+
+	Check(!((state == READING) && masterAck), "stop without a NACK to end the read", pointer);
+	if ((state == WRITING) && (latchCount > 0)) {
+		for (i=0; i<ROMPAGE; i++) {
+			if (latched[i]) rom[(pointer & ~(ROMPAGE-1)) + i] = latch[i];
+		}
+		cycle = 20 + rand() % 400;
+		cycles++;
+	}
+	state = FREE;
+}
+
+static BOOL DeviceWrite (unsigned char b) {
+	// A byte from the master -- returns TRUE to acknowledge it
+	switch (state) {
+		case CONTROLBYTE:
+			if ((cycle > 0) || ((b & 0xFE) != CONTROL)) {
+				Check(cycle > 0, "wrong control byte", b);
+				state = IGNORING;
+				return FALSE;
+			}
+			if (b & 1) {
+				state = READING;			// current address read
+				masterAck = TRUE;
+			} else state = ADDRHI;
+			return TRUE;
+		case ADDRHI:
+			Check(b < (ROMSIZE >> 8), "address past the end", b);
+			pointer = (unsigned int)(b & ((ROMSIZE >> 8) - 1)) << 8;
+			state = ADDRLO;
+			return TRUE;
+		case ADDRLO:
+			pointer |= b;
+			state = WRITING;
+			return TRUE;
+		case WRITING:
+			Check((latchCount == 0) || ((pointer & (ROMPAGE-1)) != 0), "write wraps in the page", pointer);
+			latch[pointer & (ROMPAGE-1)] = b;
+			latched[pointer & (ROMPAGE-1)] = TRUE;
+			latchCount++;
+			pointer = (pointer & ~(ROMPAGE-1)) | ((pointer + 1) & (ROMPAGE-1));
+			return TRUE;
+		case READING:
+			Check(FALSE, "byte sent during a read", b);
+			return FALSE;
+		default:
+			Check(FALSE, "byte sent after a NACK", b);
+			return FALSE;
+	}
+}
+
+static unsigned char DeviceRead (void) {
+	// A byte for the master
+	unsigned char b;
+
+	if (state == IGNORING) return 0xFF;		// nobody drives the bus
+	Check((state == READING) && masterAck, "read without an acknowledged byte before it", state);
+	b = rom[pointer];
+	pointer = (pointer + 1) % ROMSIZE;
+	return b;
+}
+
+// Simulated MSSP1
+static volatile MSSP_t mssp = { IDLEBUF };
+static unsigned char active;			// operation in progress
+static unsigned char sending;			// byte being sent
+static unsigned char busy;				// register accesses until it finishes
+static BOOL busBusy;					// between a start and a stop
+static BOOL ackDue;						// a received byte waits for ACKEN
+static unsigned long accesses;
+
+static void Finish (void) {
+	// Completes the active operation and raises SSP1IF
+	switch (active) {
+		case SEN:
+			Check(!busBusy, "start while the bus is busy", accesses);
+			busBusy = TRUE;
+			DeviceStart();
+			bits++;
+			break;
+		case RSEN:
+			Check(busBusy, "repeated start on an idle bus", accesses);
+			DeviceStart();
+			bits++;
+			break;
+		case PEN:
+			Check(busBusy, "stop on an idle bus", accesses);
+			busBusy = FALSE;
+			DeviceStop();
+			bits++;
+			break;
+		case SEND:
+			Check(busBusy, "byte sent on an idle bus", accesses);
+			mssp.con2.ACKSTAT = !DeviceWrite(sending);
+			mssp.stat.R_nW = 0;
+			bits += 9;
+			break;
+		case RCEN:
+			Check(busBusy, "byte received on an idle bus", accesses);
+			mssp.buf = IDLEBUF | DeviceRead();
+			mssp.stat.BF = 1;
+			ackDue = TRUE;
+			bits += 8;
+			break;
+		case ACKEN:
+			Check(ackDue, "acknowledge without a received byte", accesses);
+			masterAck = !mssp.con2.ACKDT;
+			ackDue = FALSE;
+			bits++;
+			break;
+	}
+	mssp.con2.reg &= ~active;
+	mssp.pir1.SSP1IF = 1;
+	active = 0;
+}
+
+volatile MSSP_t *MSSP_Access (void) {
+	// Runs the bus model for one access to an MSSP1 register by the driver
+	unsigned char requests;
+
+	accesses++;
+	if (cycle > 0) cycle--;
+	requests = mssp.con2.reg & (SEN | RSEN | PEN | RCEN | ACKEN) & ~active;
+	if (mssp.buf < IDLEBUF) requests |= SEND;
+	if (active != 0) {
+		// the driver has to wait for the active operation to finish
+		Check(requests == 0, "operation started before the last one finished", requests);
+		mssp.con2.reg &= ~requests;
+		mssp.buf |= IDLEBUF;					// write collision
+		if (--busy == 0) Finish();
+	} else if (requests != 0) {
+		Check((requests & (requests - 1)) == 0, "two operations started together", requests);
+		Check(!(ackDue && (requests != ACKEN)), "received byte not acknowledged", requests);
+		active = requests & -requests;
+		if (active == SEND) {
+			sending = (unsigned char)mssp.buf;
+			mssp.buf |= IDLEBUF;
+			mssp.stat.R_nW = 1;
+		}
+		if (active == RCEN) mssp.stat.BF = 0;
+		busy = 1 + rand() % 4;
+	}
+	return &mssp;
+}
+
+// What the EEPROM should hold
+static unsigned char image[ROMSIZE];
+
+static void Operate (void) {
+	// Makes a random EEPROM access and checks it against image[]
+	static unsigned char buffer[3*ROMPAGE];
+	unsigned int add, size, i;
+
+	size = 1 + rand() % ((rand() % 4) ? 8 : sizeof(buffer));
+	add = rand() % (ROMSIZE - size);
+	if (rand() % 8 == 0) add &= ~(ROMPAGE-1);				// whole pages
+	switch (rand() % 8) {
+		case 0: case 1:
+			for (i=0; i<size; i++) buffer[i] = rand() % 256;
+			EEPROM_Write(add, buffer, size);
+			memcpy(&image[add], buffer, size);
+			break;
+		case 2:
+			buffer[0] = rand() % 256;
+			EEPROM_WriteChar(add, buffer[0]);
+			image[add] = buffer[0];
+			break;
+		case 3:
+			EEPROM_Read(add, buffer, size);
+			Check(memcmp(buffer, &image[add], size) == 0, "read", add);
+			break;
+		case 4:
+			Check(EEPROM_ReadChar(add) == image[add], "read char", add);
+			break;
+		case 5:
+			EEPROM_OpenRead(add);
+			for (i=0; i<size; i++) Check(EEPROM_ReadNext() == image[add+i], "read stream", add+i);
+			EEPROM_CloseRead();
+			break;
+		case 6:
+			EEPROM_Busy();
+			break;
+		default:
+			EEPROM_Flush();
+			Check(memcmp(rom, image, ROMSIZE) == 0, "flushed", add);
+			break;
+	}
+}
+
+static int Test (void) {
+	unsigned int n, writes, polls, maxPolls;
+	unsigned long clock;
+
+	srand(1);
+	memset(rom, 0xFF, sizeof(rom));
+	memset(image, 0xFF, sizeof(image));
+	EEPROM_Init();
+
+	// baud rate generator and slew rate control for the bus speed
+	clock = _XTAL_FREQ / (4UL * (SSP1ADD + 1));
+	Check(SSP1CON1 == 0x28, "master mode", SSP1CON1);
+	Check((clock <= I2C_SPEED) && ((clock >= 9*I2C_SPEED/10) || (SSP1ADD == 3)), "bus clock", clock);
+	Check((SSP1STAT == 0x80) == (I2C_SPEED <= 100000UL), "slew rate control", SSP1STAT);
+	Check(EEPROM_Present(), "present", 0);
+
+	for (n=0; n<OPERATIONS; n++) Operate();
+	EEPROM_Flush();
+	Check(EEPROM_Present(), "present after writing", 0);
+	Check(memcmp(rom, image, ROMSIZE) == 0, "contents", 0);
+	Check(!busBusy && (active == 0), "bus left idle", accesses);
+
+	EEPROM_GetStats(&writes, &polls, &maxPolls);
+	Check(writes == cycles, "write cycles", writes);
+	Check(maxPolls < MAXPOLLS, "gave up polling", maxPolls);
+
+	printf("%u operations at a %lukHz bus clock: %u page writes, %lu bus clocks (%lumS)\n",
+		   OPERATIONS, clock / 1000, cycles, bits, bits * 1000 / clock);
+	printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+	if ((argc == 2) && (strcmp(argv[1], "test") == 0)) return Test();
+	fprintf(stderr, "usage: %s test\n", argv[0]);
+	return 2;
+}
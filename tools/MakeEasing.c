@@ -0,0 +1,59 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	MakeEasing.c
+* \details  Host program that generates the \em Easing.inc fade curve tables used
+*			by \em PWM.c.  Each curve maps the fade progress (0 to 1) to the 
+*			fraction of the colour change that has been made.  The curves are
+*			sampled at EASEPOINTS+1 points and scaled to 0..255; the ISR 
+*			interpolates between the points.
+*
+*			Build and run on the host:
+*				cc -o MakeEasing MakeEasing.c -lm
+*				./MakeEasing > ../Easing.inc
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//************************************************************************************
+
+#include <stdio.h>
+#include <math.h>
+
+#define EASEPOINTS	64					// curve intervals -- must match PWM.c
+
+static double Curve (unsigned int curve, double p) {
+	switch (curve) {
+		case 0: return p * p;								// ease in
+		case 1: return 1.0 - (1.0 - p) * (1.0 - p);			// ease out
+		case 2: return p * p * (3.0 - 2.0 * p);				// S-curve (ease in and out)
+		default: return (exp(5.0 * p) - 1.0) / (exp(5.0) - 1.0);	// exponential
+	}
+}
+
+int main (void) {
+	static const char *names[] = {"Ease in", "Ease out", "S-curve", "Exponential"};
+	unsigned int curve, i;
+	
+	printf("//************************************************************************************\r\n");
+	printf("//\r\n");
+	printf("// This file is generated by tools/MakeEasing.c -- do not edit.\r\n");
+	printf("//\r\n");
+	printf("//************************************************************************************\r\n\r\n");
+	
+	printf("const unsigned char Easing[][%u] = \r\n{", EASEPOINTS+1);
+	for (curve=0; curve<4; curve++) {
+		printf("\r\n\t{\t// %s", names[curve]);
+		for (i=0; i<=EASEPOINTS; i++) {
+			if ((i & 7) == 0) printf("\r\n\t\t");
+			printf("0x%02X%s", (unsigned int)floor(Curve(curve, (double)i / EASEPOINTS) * 255.0 + 0.5),
+				(i < EASEPOINTS) ? ", " : "");
+		}
+		printf("\r\n\t}%s", (curve < 3) ? "," : "");
+	}
+	printf("\r\n};\r\n");
+	return 0;
+}
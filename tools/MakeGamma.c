@@ -0,0 +1,64 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	MakeGamma.c
+* \details  Host program that generates the \em Gamma.inc perceptual brightness
+*			tables used by \em PWM.c.  Each 8-bit intensity is mapped to a 10-bit
+*			PWM duty cycle using the CIE 1931 lightness curve.  The upper 8 bits
+*			and the lower 2 bits of the duty cycle are stored in separate tables
+*			with four of the 2-bit values packed into each byte to save FLASH.
+*
+*			Build and run on the host:
+*				cc -o MakeGamma MakeGamma.c -lm
+*				./MakeGamma > ../Gamma.inc
+* \author   agent
+* \date   	16 Oct 2026
+*/ 
+//************************************************************************************
+
+#include <stdio.h>
+#include <math.h>
+
+#define LEVELS		256					// input intensity levels
+#define PWM_FULL	1023				// 10-bit PWM duty cycle for 100% intensity
+
+static unsigned int Lightness (unsigned int level) {
+	// Returns the duty cycle that gives a perceived lightness of 'level'
+	double L = 100.0 * level / (LEVELS-1);
+	double Y;
+	
+	if (L <= 8.0) Y = L / 903.3;
+	else Y = pow((L + 16.0) / 116.0, 3.0);
+	return (unsigned int)floor(Y * PWM_FULL + 0.5);
+}
+
+int main (void) {
+	unsigned int i, j, packed;
+	
+	printf("//************************************************************************************\r\n");
+	printf("//\r\n");
+	printf("// This file is generated by tools/MakeGamma.c -- do not edit.\r\n");
+	printf("//\r\n");
+	printf("//************************************************************************************\r\n\r\n");
+	
+	printf("const unsigned char GammaHigh[] = \t// Upper 8 bits of the 10-bit duty cycle\r\n{");
+	for (i=0; i<LEVELS; i++) {
+		if ((i & 7) == 0) printf("\r\n\t");
+		printf("0x%02X%s", Lightness(i) >> 2, (i < LEVELS-1) ? ", " : "");
+	}
+	printf("\r\n};\r\n\r\n");
+	
+	printf("const unsigned char GammaLow[] = \t// Lower 2 bits of the duty cycle -- four per byte\r\n{");
+	for (i=0; i<LEVELS; i+=4) {
+		if ((i & 31) == 0) printf("\r\n\t");
+		packed = 0;
+		for (j=0; j<4; j++) packed |= (Lightness(i+j) & 3) << (2*j);
+		printf("0x%02X%s", packed, (i < LEVELS-4) ? ", " : "");
+	}
+	printf("\r\n};\r\n");
+	return 0;
+}
@@ -0,0 +1,238 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	PWMLatch.c
+* \details  Host test that \em PWM_Set in \em PWM.c never shows a partial update.
+*			The foreground calls PWM_Set() as fast as it can with new values
+*			for all four channels, sometimes sets a dimmer so the next tick
+*			rewrites the outputs too, and steps through every carrier and at
+*			32MHz both clocks.  A POSIX
+*			interval timer interrupts it at arbitrary points, including part
+*			way through PWM_Set(), and runs Timer2 for a random time.
+*
+*			Time only passes in the interrupt.  Timer2 counts through each
+*			access the interrupt makes to TMR2 or a duty cycle register, through
+*			the interrupt latency, and through the fade work of a tick, which is
+*			charged when the tick reads TMR4 and can take many periods.  At each
+*			period boundary the CCP modules load their duty cycles for the next
+*			period, and the four loaded duty cycles must all come from the same
+*			call and never from an older call than the last period.  The values
+*			from the latest call must show after the first Timer2 interrupt that
+*			gets in early in a period.
+*
+*			Build and run on the host at both clocks:
+*				cc -I. -o PWMLatch PWMLatch.c
+*				./PWMLatch test
+*				cc -I. -DCLOCK_32MHZ -o PWMLatch PWMLatch.c
+*				./PWMLatch test
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#define PWM_MODEL
+#include "../Types.h"
+
+#define CALLS		2000000				// PWM_Set calls
+#define CARRIERCALLS 100000				// PWM_Set calls on each carrier
+#define INTERVAL	20					// uS between simulated interrupts
+#define ACCESSTCY	4					// instruction cycles for each register access
+#define ENTRYTCY	5					// interrupt latency and context save
+#define TICKTCY		2000				// most instruction cycles of fade work in a tick
+
+// Scheduler and RS-485 state used by the interrupt
+#include "../RS485.h"
+volatile unsigned char schedTicks, schedEvents, schedSubTicks;
+unsigned char RS485_RxBuf[256];
+unsigned char RS485_WtPtr;
+unsigned char RS485_TxBuf[RS485_TXSIZE];
+volatile unsigned char RS485_TxRdPtr;
+unsigned char RS485_TxWtPtr;
+
+void WriteByte (unsigned char add, unsigned char data) { eeprom_write(add, data); }
+
+#include "../PWM.c"
+
+// Duty cycles expected from each call in CCP1 to CCP4 order
+static unsigned int posted[CALLS+1][4];
+static volatile unsigned long last;		// latest call posted
+static volatile unsigned long shown;	// call loaded at the last period boundary
+static volatile unsigned long periods;	// Timer2 period boundaries
+static volatile unsigned long early;	// Timer2 interrupts that got in early in a period
+static volatile unsigned long preempted;	// interrupts that landed inside PWM_Set
+static volatile BOOL inSet;
+static unsigned int seed = 1;
+
+static volatile int failures;
+
+static void Check (int ok, const char *test, unsigned long detail) {
+	if (!ok) {
+		failures++;
+		if (failures < 20) printf("FAIL: %s (%lu)\n", test, detail);
+	}
+}
+
+// Simulated Timer2 and CCP modules
+static volatile PWM_t pwm;
+static unsigned char tmr4;
+static unsigned int prescaler;			// instruction cycles toward the next Timer2 count
+static BOOL running;					// Timer2 counts through register accesses
+
+static void Duties (unsigned int duties[4]) {
+	// The duty cycles in the CCP registers
+	duties[0] = (pwm.ccpr1l << 2) | pwm.ccp1con.DC1B;
+	duties[1] = (pwm.ccpr2l << 2) | pwm.ccp2con.DC2B;
+	duties[2] = (pwm.ccpr3l << 2) | pwm.ccp3con.DC3B;
+	duties[3] = (pwm.ccpr4l << 2) | pwm.ccp4con.DC4B;
+}
+
+static void Boundary (void) {
+	// The CCP modules load the duty cycles for the new period
+	unsigned int duties[4];
+	unsigned long n;
+
+	Duties(duties);
+	for (n=shown; n<=last; n++) {
+		if (memcmp(duties, posted[n], sizeof(duties)) == 0) break;
+	}
+	Check(n <= last, "partial or stale update", periods);
+	if (n <= last) shown = n;
+	periods++;
+	TMR2IF = 1;
+}
+
+static void Run (unsigned long tcy) {
+	// Runs Timer2 for 'tcy' instruction cycles
+	unsigned int scale = 1 << (T2CONbits.T2CKPS << 1);
+
+	for (tcy += prescaler; tcy >= scale; tcy -= scale) {
+		if (pwm.tmr2 == PR2) {
+			pwm.tmr2 = 0;
+			Boundary();
+		} else pwm.tmr2++;
+	}
+	prescaler = tcy;
+}
+
+volatile PWM_t *PWM_Access (void) {
+	if (running) Run(ACCESSTCY);
+	return &pwm;
+}
+
+volatile unsigned char *PWM_Timer4 (void) {
+	// The tick reads TMR4 when its fade work is done
+	if (running) Run(rand_r(&seed) % TICKTCY);
+	return &tmr4;
+}
+
+static void Expected (const unsigned char values[4], unsigned int duties[4]) {
+	// Works out the duty cycles for 'values' -- CH1 is on CCP2, CH2 on CCP3, CH3 on CCP1
+	static const unsigned char module[4] = { 1, 2, 0, 3 };
+	unsigned int duty, index;
+	unsigned char i;
+
+	for (i=CH1; i<=CH4; i++) {
+		index = DIMMED(i, QUARTERS(LEVEL(values[i])));
+		DUTY(index);
+		duties[module[i]] = duty;
+	}
+}
+
+static void Interrupt (int sig) {
+	// Runs Timer2 up to a random point then any enabled interrupts
+	unsigned long period = (unsigned long)(PR2 + 1) << (T2CONbits.T2CKPS << 1);
+
+	if (inSet) preempted++;
+	Run(rand_r(&seed) % (3 * period));
+	if (rand_r(&seed) % 4 == 0) TMR4IF = 1;
+	running = TRUE;
+	while (((TMR4IE) && (TMR4IF)) || ((TMR2IE) && (TMR2IF))) {
+		Run(ENTRYTCY);
+		if ((TMR2IE) && (TMR2IF) && (pwm.tmr2 < latchLimit / 2)) early++;
+		generic_isr();
+	}
+	running = FALSE;
+}
+
+static int Test (void) {
+	struct itimerval timer;
+	sigset_t block;
+	unsigned char values[4];
+	unsigned long n, wait;
+	unsigned char i, mode = DEFCARRIER;
+
+	srand(1);
+	memset((void *)hostEEPROM, 0xFF, sizeof(hostEEPROM));
+	PWM_Init();
+	Duties(posted[0]);
+	sigemptyset(&block);
+	sigaddset(&block, SIGALRM);
+	signal(SIGALRM, Interrupt);
+	timer.it_interval.tv_sec = 0; timer.it_interval.tv_usec = INTERVAL;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_REAL, &timer, NULL);
+
+	for (n=1; n<=CALLS; n++) {
+		if (n % CARRIERCALLS == 0) {
+			// the next carrier relatches the present values with its own scaling
+			mode = (mode + 1) % CARRIERS;
+			sigprocmask(SIG_BLOCK, &block, NULL);
+			Check(PWM_SetCarrier(mode), "carrier", mode);
+			Expected(values, posted[n]);
+			last = n;
+			sigprocmask(SIG_UNBLOCK, &block, NULL);
+			continue;
+		}
+
+		for (i=CH1; i<=CH4; i++) values[i] = rand() % 256;
+		sigprocmask(SIG_BLOCK, &block, NULL);
+		Expected(values, posted[n]);
+		last = n;
+		sigprocmask(SIG_UNBLOCK, &block, NULL);
+
+		inSet = TRUE;
+		PWM_Set(values[CH1], values[CH2], values[CH3], values[CH4]);
+		inSet = FALSE;
+		if (rand() % 8 == 0) PWM_SetDimmer(PWM_MASTER, 255);	// the next tick rewrites the outputs
+#ifdef CLOCK_32MHZ
+		if (rand() % 64 == 0) {
+			// the idle clock drops the Timer2 prescale a step
+			sigprocmask(SIG_BLOCK, &block, NULL);
+			PWM_SetClock(rand() % 2);
+			sigprocmask(SIG_UNBLOCK, &block, NULL);
+		}
+#endif
+
+		// sometimes wait for the values to show
+		if (rand() % 1000 == 0) {
+			wait = early + 2;
+			while ((shown != n) && (early < wait)) continue;
+			Check(shown == n, "shown after the first early interrupt", n);
+		}
+	}
+
+	timer.it_value.tv_usec = 0; timer.it_interval.tv_usec = 0;
+	setitimer(ITIMER_REAL, &timer, NULL);
+	Check(preempted > 100, "interrupts inside PWM_Set", preempted);
+
+	printf("%u PWM_Set calls on %u carriers, %lu period boundaries, %lu interrupts inside PWM_Set\n",
+		   CALLS, (unsigned)CARRIERS, periods, preempted);
+	printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+	if ((argc == 2) && (strcmp(argv[1], "test") == 0)) return Test();
+	fprintf(stderr, "usage: %s test\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,166 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	PWMQueue.c
+* \details  Host timing test of the ramp queue in \em PWM.c.  Random segments
+*			of short, long, and eased fades, with and without holds, are
+*			queued with PWM_Ramp() by a simulated foreground that keeps the
+*			queue topped up as the playback loop does but is sometimes a few
+*			ticks late.  The Timer4 tick interrupt is run on its own and the
+*			test checks that every segment starts on the exact tick the one
+*			before it finishes its fade and hold, so there is never an idle
+*			tick between segments, and that every fade reaches its target on
+*			the tick it should.
+*
+*			Build and run on the host, at 4MHz and at 32MHz where each tick
+*			is made of several Timer4 periods:
+*				cc -I. -o PWMQueue PWMQueue.c
+*				./PWMQueue test
+*				cc -I. -DCLOCK_32MHZ -o PWMQueue PWMQueue.c
+*				./PWMQueue test
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Types.h"
+
+#define SEGMENTS	5000				// random segments played
+#define LATE		3					// most ticks the foreground is late
+
+// Scheduler and RS-485 state used by the interrupt
+#include "../RS485.h"
+volatile unsigned char schedTicks, schedEvents, schedSubTicks;
+unsigned char RS485_RxBuf[256];
+unsigned char RS485_WtPtr;
+unsigned char RS485_TxBuf[RS485_TXSIZE];
+volatile unsigned char RS485_TxRdPtr;
+unsigned char RS485_TxWtPtr;
+
+void WriteByte (unsigned char add, unsigned char data) { eeprom_write(add, data); }
+
+#include "../PWM.c"
+
+// What each segment should do
+typedef struct _Segment {
+	unsigned char pwm[4];
+	unsigned char fade, hold;
+	unsigned long ticks;				// fade length in ticks
+	unsigned long start;				// tick the segment should start on
+} Segment;
+
+static Segment segs[SEGMENTS];
+static unsigned char from[4];			// targets of the last segment made
+static unsigned long ticks;				// ticks run
+
+static int failures;
+
+static void Check (int ok, const char *test, unsigned long detail) {
+	if (!ok) {
+		failures++;
+		if (failures < 20) printf("FAIL: %s (%lu)\n", test, detail);
+	}
+}
+
+static void Tick (void) {
+	// Runs the Timer4 interrupts that make up one tick
+	unsigned char n;
+
+	for (n=0; n<SUBTICKS; n++) {
+		TMR4IF = 1;
+		generic_isr();
+	}
+	ticks++;
+}
+
+static void MakeSegment (Segment *s) {
+	// Picks a random segment and works out how many ticks its fade takes
+	unsigned char i, move = 0;
+
+	for (i=CH1; i<=CH4; i++) {
+		s->pwm[i] = (rand() % 4) ? rand() % 256 : from[i] + rand() % 3 - 1;	// sometimes a small move
+		if (Distance(from[i], s->pwm[i]) > move) move = Distance(from[i], s->pwm[i]);
+		from[i] = s->pwm[i];
+	}
+	switch (rand() % 8) {
+		case 0:  s->fade = EASEFADE + rand() % (FASTFADE-EASEFADE); break;		// eased
+		case 1:  s->fade = rand() % 3; break;									// immediate or a step per 2 or 3 ticks
+		case 2:  s->fade = (rand() % 8) ? 3 + rand() % 30 : rand() % EASEFADE; break;	// slower step rates
+		default: s->fade = FASTFADE + rand() % 15; break;						// 1 to 15 ticks
+	}
+	s->hold = (rand() % 3) ? 0 : rand() % 4;
+	if (s->fade >= FASTFADE) s->ticks = s->fade - FASTFADE + 1;
+	else if (s->fade >= EASEFADE) s->ticks = FADESTEPS*(unsigned long)((s->fade - EASEFADE) % EASEUNITS + 1);
+	else if ((s->fade == 0) || (move == 0)) s->ticks = 1;
+	else s->ticks = (s->fade + 1)*(unsigned long)move;
+}
+
+static int Test (void) {
+	unsigned int queued = 0, started = 0, ended = 0, n, late = 0;
+	unsigned char tail, i;
+
+	srand(1);
+	memset((void *)hostEEPROM, 0xFF, sizeof(hostEEPROM));
+	PWM_Init();
+	for (n=0; n<SEGMENTS; n++) MakeSegment(&segs[n]);
+
+	while (ended < SEGMENTS) {
+		// the foreground keeps the queue full unless it is busy elsewhere
+		if (late > 0) late--;
+		else {
+			while ((queued < SEGMENTS) && !PWM_Full()) {
+				Check(PWM_Ramp(segs[queued].pwm[CH1], segs[queued].pwm[CH2], segs[queued].pwm[CH3],
+							   segs[queued].pwm[CH4], segs[queued].fade, segs[queued].hold), "queued", queued);
+				queued++;
+			}
+			if (rand() % 8 == 0) late = 1 + rand() % LATE;
+		}
+
+		tail = queueTail;
+		schedEvents = 0;
+		Tick();
+
+		// a segment started -- the first on the first tick and the rest with no gap
+		if (tail != queueTail) {
+			Check((unsigned char)(queueTail - tail) == 1, "one start per tick", ticks);
+			Check(schedEvents & PWM_EVENT, "start event", started);
+			if (started == 0) segs[0].start = ticks;
+			else Check(ticks == segs[started-1].start + segs[started-1].ticks + 10UL*segs[started-1].hold, "no gap", started);
+			segs[started].start = ticks;
+			started++;
+		}
+
+		// the running fade reaches its targets on its last tick
+		if ((started > ended) && (ticks == segs[ended].start + segs[ended].ticks)) {
+			for (i=CH1; i<=CH4; i++) Check(prevPWM[i] == LEVEL(segs[ended].pwm[i]), "target", ended);
+		}
+		if ((started > ended) && (ticks == segs[ended].start + segs[ended].ticks + 10UL*segs[ended].hold)) ended++;
+
+		// never idle while there is a segment left to play
+		if (ended < SEGMENTS) Check(PWM_Busy() && (started > ended), "idle tick", ticks);
+		if (ticks > 10000000UL) {
+			Check(FALSE, "stuck", ended);
+			break;
+		}
+	}
+	Tick();
+	Check(!PWM_Busy(), "finished", ticks);
+	Check(PWM_Drops() == 0, "drops", PWM_Drops());
+
+	printf("%u segments in %lu ticks with %u Timer4 periods per tick\n", ended, ticks, SUBTICKS);
+	printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+	if ((argc == 2) && (strcmp(argv[1], "test") == 0)) return Test();
+	fprintf(stderr, "usage: %s test\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,252 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	SBUSFrame.c
+* \details  Host program that encodes and decodes the binary SBUS frames handled
+*			by \em SBUS.c.  A frame is an STX (0x02), the device, command, and
+*			two address bytes, the data as chunks of a length byte (1 to 255)
+*			followed by that many bytes, a zero length byte, and the CRC-16
+*			(Modbus polynomial, low byte first) of everything after the STX.
+*			Frames are written and read as the hexadecimal digits of an ASCII
+*			frame without the ":", the LRC, and the <CR><LF>.
+*
+*			Build and run on the host:
+*				cc -o SBUSFrame SBUSFrame.c
+*				./SBUSFrame encode 05901122334400 > frame.bin
+*				./SBUSFrame decode < frame.bin
+*				./SBUSFrame test
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STX			0x02				// start of a binary frame
+#define HEADER		4					// device, command, and address bytes
+#define MAXCHUNK	255					// most data bytes in a chunk
+#define MAXDATA		8192				// most data bytes in a decoded frame
+#define MAXFRAME	(1 + HEADER + 2*MAXDATA + 3)	// largest frame -- one byte chunks
+
+typedef struct _Frame {
+	unsigned char device;
+	unsigned char command;
+	unsigned int address;
+	unsigned int length;				// data bytes
+	unsigned char data[MAXDATA];
+} Frame;
+
+static unsigned int CRC16 (const unsigned char buf[], size_t size) {
+	// Returns the CRC-16 of 'buf' with the Modbus polynomial (0xA001 reflected)
+	unsigned int crc = 0xFFFF;
+	size_t i;
+	int bit;
+
+	for (i=0; i<size; i++) {
+		crc ^= buf[i];
+		for (bit=0; bit<8; bit++) {
+			if (crc & 1) crc = (crc >> 1) ^ 0xA001;
+			else crc >>= 1;
+		}
+	}
+	return crc;
+}
+
+static size_t Encode (const Frame *frame, unsigned int chunk, unsigned char out[]) {
+	// Encodes 'frame' into 'out' with data chunks of up to 'chunk' bytes.  Returns the frame size.
+	size_t n = 0;
+	unsigned int i, size, crc;
+
+	out[n++] = STX;
+	out[n++] = frame->device;
+	out[n++] = frame->command;
+	out[n++] = frame->address >> 8;
+	out[n++] = frame->address & 0xFF;
+	for (i=0; i<frame->length; i+=size) {
+		size = frame->length - i;
+		if (size > chunk) size = chunk;
+		out[n++] = size;
+		memcpy(&out[n], &frame->data[i], size);
+		n += size;
+	}
+	out[n++] = 0;
+	crc = CRC16(&out[1], n-1);
+	out[n++] = crc & 0xFF;
+	out[n++] = crc >> 8;
+	return n;
+}
+
+static long Decode (const unsigned char in[], size_t size, Frame *frame) {
+	// Decodes the frame at the start of 'in'.  Returns the frame size, 0 if the frame
+	// isn't complete yet, or -1 if it isn't a good frame.
+	size_t n = 1 + HEADER;
+	unsigned int chunk;
+
+	if (size < 1) return 0;
+	if (in[0] != STX) return -1;
+	if (size < n) return 0;
+	frame->device = in[1];
+	frame->command = in[2];
+	frame->address = ((unsigned int)in[3] << 8) | in[4];
+	frame->length = 0;
+	for (;;) {
+		if (n >= size) return 0;
+		chunk = in[n++];
+		if (chunk == 0) break;
+		if (n + chunk > size) return 0;
+		if (frame->length + chunk > MAXDATA) return -1;
+		memcpy(&frame->data[frame->length], &in[n], chunk);
+		frame->length += chunk;
+		n += chunk;
+	}
+	if (n + 2 > size) return 0;
+	if (CRC16(&in[1], n-1) != (in[n] | ((unsigned int)in[n+1] << 8))) return -1;
+	return n + 2;
+}
+
+static int FromHex (const char *hex, Frame *frame) {
+	// Fills 'frame' from the hexadecimal digits of an ASCII frame.  Returns 0 if they're bad.
+	unsigned char bytes[HEADER + MAXDATA];
+	size_t i, len = strlen(hex);
+	unsigned int byte;
+
+	if (hex[0] == ':') { hex++; len--; }
+	if ((len & 1) || (len < 2*HEADER) || (len > 2*sizeof(bytes))) return 0;
+	for (i=0; i<len/2; i++) {
+		if (sscanf(&hex[2*i], "%2x", &byte) != 1) return 0;
+		bytes[i] = byte;
+	}
+	frame->device = bytes[0];
+	frame->command = bytes[1];
+	frame->address = ((unsigned int)bytes[2] << 8) | bytes[3];
+	frame->length = len/2 - HEADER;
+	memcpy(frame->data, &bytes[HEADER], frame->length);
+	return 1;
+}
+
+static void PrintHex (FILE *f, const Frame *frame) {
+	unsigned int i;
+
+	fprintf(f, "%02X%02X%04X", frame->device, frame->command, frame->address);
+	for (i=0; i<frame->length; i++) fprintf(f, "%02X", frame->data[i]);
+	fprintf(f, "\n");
+}
+
+static int Same (const Frame *a, const Frame *b) {
+	return (a->device == b->device) && (a->command == b->command) && (a->address == b->address) &&
+		   (a->length == b->length) && (memcmp(a->data, b->data, a->length) == 0);
+}
+
+static int failures;
+
+static void Check (int ok, const char *test, unsigned int detail) {
+	if (!ok) {
+		failures++;
+		printf("FAIL: %s (%u)\n", test, detail);
+	}
+}
+
+static int Test (void) {
+	static const unsigned int lengths[] = {0, 1, 2, 31, 32, 33, 254, 255, 256, 257, 511, 1000, MAXDATA};
+	static const unsigned int chunks[] = {1, 2, 32, 255};
+	static const unsigned char reportAll[] = {STX, 0xFF, 0x60, 0xFF, 0xFF, 0x00, 0x5F, 0xD4};
+	static Frame in, out;
+	static unsigned char buf[MAXFRAME], bad[MAXFRAME];
+	unsigned int l, c, i, bit;
+	size_t size, cut;
+	long used;
+
+	// CRC-16/MODBUS check value
+	Check(CRC16((const unsigned char *)"123456789", 9) == 0x4B37, "CRC check value", 0);
+
+	// known frame: report all items from any device
+	in.device = 0xFF; in.command = 0x60; in.address = 0xFFFF; in.length = 0;
+	size = Encode(&in, MAXCHUNK, buf);
+	Check((size == sizeof(reportAll)) && (memcmp(buf, reportAll, size) == 0), "report frame", size);
+
+	// round trips of every size and chunking with data that includes the ASCII framing characters
+	srand(1);
+	for (l=0; l<sizeof(lengths)/sizeof(lengths[0]); l++) {
+		for (c=0; c<sizeof(chunks)/sizeof(chunks[0]); c++) {
+			in.device = rand(); in.command = rand() & 0xF0; in.address = rand() & 0xFFFF;
+			in.length = lengths[l];
+			for (i=0; i<in.length; i++) in.data[i] = (i % 7 == 0) ? ":\r\n\x02"[i % 4] : rand();
+			size = Encode(&in, chunks[c], buf);
+			used = Decode(buf, size, &out);
+			Check((used == (long)size) && Same(&in, &out), "round trip", lengths[l]*1000 + chunks[c]);
+
+			// every truncation is incomplete
+			for (cut=0; cut<size && cut<300; cut++) {
+				Check(Decode(buf, cut, &out) == 0, "truncated", cut);
+			}
+		}
+	}
+
+	// every single bit error is caught
+	in.device = 0x05; in.command = 0x20; in.address = 0x0003; in.length = 40;
+	for (i=0; i<in.length; i++) in.data[i] = i * 37;
+	size = Encode(&in, 32, buf);
+	for (i=0; i<size; i++) {
+		for (bit=0; bit<8; bit++) {
+			memcpy(bad, buf, size);
+			bad[i] ^= 1 << bit;
+			Check(Decode(bad, size, &out) <= 0, "bit error", i*8 + bit);
+		}
+	}
+
+	// the digits of an ASCII frame convert to a frame
+	Check(FromHex(":05901122334400", &in) && (in.device == 0x05) && (in.command == 0x90) &&
+		  (in.address == 0x1122) && (in.length == 3) && (in.data[2] == 0x00), "hex frame", 0);
+	Check(!FromHex("0590112", &in), "odd hex frame", 0);
+
+	printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+	static Frame frame;
+	static unsigned char buf[MAXFRAME];
+	size_t size = 0, start = 0;
+	long used;
+
+	if ((argc == 3) && (strcmp(argv[1], "encode") == 0)) {
+		if (!FromHex(argv[2], &frame)) {
+			fprintf(stderr, "bad frame: %s\n", argv[2]);
+			return 1;
+		}
+		size = Encode(&frame, MAXCHUNK, buf);
+		fwrite(buf, 1, size, stdout);
+		return 0;
+	} else if ((argc == 2) && (strcmp(argv[1], "decode") == 0)) {
+		// print each frame in the input -- anything else (such as ASCII frames) is skipped
+		size = fread(buf, 1, sizeof(buf), stdin);
+		while (start < size) {
+			if (buf[start] != STX) {
+				start++;
+				continue;
+			}
+			used = Decode(&buf[start], size - start, &frame);
+			if (used > 0) {
+				PrintHex(stdout, &frame);
+				start += used;
+			} else if (used == 0) {
+				fprintf(stderr, "incomplete frame at %lu\n", (unsigned long)start);
+				break;
+			} else {
+				fprintf(stderr, "bad frame at %lu\n", (unsigned long)start);
+				start++;
+			}
+		}
+		return 0;
+	} else if ((argc == 2) && (strcmp(argv[1], "test") == 0)) {
+		return Test();
+	}
+	fprintf(stderr, "usage: %s encode DDCCAAAA[data] | decode | test\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,355 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	SBUSSplit.c
+* \details  Host test of the incremental frame parser in \em SBUS.c.  ASCII and
+*			binary frames, with truncated frames and noise between them, are
+*			fed to SBUS_Process_Command() in pieces split at random points
+*			with a call after each piece.  The test checks that every frame is
+*			carried out exactly once with the right data and reply, and that
+*			frames for other devices and damaged frames are ignored.  Long 
+*			READSEGS and READMACROS replies are checked byte for byte.
+*
+*			The RS-485 port is simulated.  Its transmit buffer is as big as
+*			the real one and the UART sends a character from it every 1mS or
+*			so at 9600 baud, starting the call after the driver turns on.  A
+*			write to a full buffer waits for the UART.  A tick passes between
+*			calls and every call, reply included, must return within a tick.
+*
+*			Build and run on the host:
+*				cc -I. -o SBUSSplit SBUSSplit.c
+*				./SBUSSplit test
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Types.h"
+#include "../PWM.h"
+#include "../Sequences.h"
+#include "../NightSense.h"
+#include "../EEPROM.h"
+#include "../Macros.h"
+#include "../MemoryMap.h"
+#include "../RS485.h"
+
+// Binary frame encoder and decoder
+#define main FrameMain
+#define Test FrameTest
+#include "SBUSFrame.c"
+#undef main
+#undef Test
+#undef STX
+#undef HEADER
+
+#define DEVICE		0x05				// device address of the controller under test
+#define TICK		5000UL				// scheduler tick in uS
+#define CHARTIME	1042UL				// one character at 9600 baud in uS
+#define FRAMES		5000				// random frames fed to the parser
+#define SETTLE		2000				// most calls for a reply to go
+
+// Simulated RS-485 port
+unsigned char RS485_RxBuf[256];
+unsigned char RS485_RdPtr, RS485_WtPtr;
+static unsigned char txBuf[4096];		// reply characters
+static unsigned int txSize;
+static unsigned int txQueued;			// characters in the transmit buffer or being sent
+static BOOL txActive;					// the driver is on
+static BOOL txStarted;					// the UART is sending
+static unsigned long txTime;			// uS toward the next character sent
+static unsigned long micros;			// time spent waiting in the port
+static unsigned int reads;				// characters read
+
+static void Send (unsigned long us) {
+	// Lets the UART send for 'us' microseconds
+	if (!txStarted) return;
+	for (txTime += us; (txTime >= CHARTIME) && (txQueued > 0); txTime -= CHARTIME) txQueued--;
+	if (txQueued == 0) txTime = 0;
+}
+
+void RS485_Init (void) { RS485_RdPtr = 0; RS485_WtPtr = 0; }
+
+BOOL RS485_CharReady (void) {
+	if (txActive) {
+		// the UART starts a call after the driver turns on and the driver is off once it's done
+		if (!txStarted) txStarted = TRUE;
+		else if (txQueued == 0) txActive = FALSE;
+		if (txActive) return FALSE;
+	}
+	return (RS485_RdPtr != RS485_WtPtr);
+}
+
+BOOL RS485_Idle (void) { return !txActive; }
+
+unsigned char RS485_TxRoom (void) { return RS485_TXSIZE - txQueued; }
+
+unsigned char RS485_ReadChar (void) {
+	Check(RS485_RdPtr != RS485_WtPtr, "read waits for a character", reads);
+	reads++;
+	return RS485_RxBuf[RS485_RdPtr++];
+}
+
+void RS485_WriteChar (unsigned char ch) {
+	if (!txActive) { txActive = TRUE; txStarted = FALSE; }
+	if (txQueued == RS485_TXSIZE) {
+		// full -- wait for the UART to send a character
+		txStarted = TRUE;
+		micros += CHARTIME;
+		Send(CHARTIME);
+	}
+	txQueued++;
+	if (txSize < sizeof(txBuf)) txBuf[txSize++] = ch;
+}
+
+void RS485_Write (unsigned char buffer[], unsigned int size) {
+	unsigned int i;
+
+	for (i=0; i<size; i++) RS485_WriteChar(buffer[i]);
+}
+
+// Controller state changed by the commands
+unsigned int activeSequence, maxAddress, minAddress;
+BOOL override, playMacros;
+static unsigned int displays;			// PWM_Set calls
+static unsigned char outputs[4];		// last PWM_Set values
+static unsigned int segments;			// segments in the last sequence write
+static unsigned char ramp[4];			// last PWM_RampChannel channel, value, fade, and hold
+static unsigned int macros[MAXMACROS];
+static unsigned int macroCount;
+
+void PWM_Set (unsigned char pwm1, unsigned char pwm2, unsigned char pwm3, unsigned char pwm4) {
+	outputs[0] = pwm1; outputs[1] = pwm2; outputs[2] = pwm3; outputs[3] = pwm4;
+	displays++;
+}
+BOOL PWM_SetCarrier (unsigned char mode) { return mode < 4; }
+unsigned char PWM_GetCarrier (unsigned int *freq, unsigned char *bits) { *freq = 244; *bits = 10; return 0; }
+BOOL PWM_SetDimmer (unsigned char ch, unsigned char level) { return TRUE; }
+unsigned char PWM_GetDimmer (unsigned char ch) { return 255; }
+BOOL PWM_SetTempo (unsigned char speed) { return speed != 0; }
+unsigned char PWM_GetTempo (void) { return PWM_TEMPO; }
+unsigned char PWM_TickTime (void) { return 20; }
+unsigned char PWM_QueueDepth (void) { return 2; }
+unsigned int PWM_Drops (void) { return 7; }
+void PWM_RampChannel (unsigned char ch, unsigned char pwm, unsigned char fade, unsigned char hold) {
+	ramp[0] = ch; ramp[1] = pwm; ramp[2] = fade; ramp[3] = hold;
+}
+FindResult Seq_Find (unsigned int seq) { return (seq < 3) ? FIND_OK : AT_LAST_SEQUENCE; }
+unsigned int Seq_CopyToBuffer (unsigned int seq, unsigned char buffer[]) { memset(buffer, seq, BYTESPERSEQ); return BYTESPERSEQ; }
+BOOL Seq_AddToMulti (unsigned int seq, unsigned char buffer[], unsigned int count) { segments = count; return TRUE; }
+BOOL Seq_New_Multi (unsigned char buffer[], unsigned int count) { segments = count; return TRUE; }
+BOOL Seq_Delete_Range (unsigned int seq, unsigned int count) { return TRUE; }
+unsigned int Seq_Count (void) { return 3; }
+void NightSense_Enable (BOOL flag) {}
+void NightSense_SetOffDelay (unsigned char delay) {}
+void NightSense_SetOnDelay (unsigned char delay) {}
+void NightSense_SetDuration (unsigned int duration) {}
+void NightSense_GetParam (BOOL *flag, unsigned int *duration, unsigned char *onTime, unsigned char *offTime) {
+	*flag = TRUE; *duration = 360; *onTime = 5; *offTime = 5;
+}
+void EEPROM_GetStats (unsigned int *writes, unsigned int *polls, unsigned int *maxPolls) { *writes = 0; *polls = 0; *maxPolls = 0; }
+void EEPROM_GetCacheStats (unsigned int *hits, unsigned int *flushes) { *hits = 0; *flushes = 0; }
+BOOL Macros_Add (unsigned int macro) { if (macroCount >= MAXMACROS) return FALSE; macros[macroCount++] = macro; return TRUE; }
+unsigned int Macros_Count (void) { return macroCount; }
+unsigned int Macros_Read (unsigned int index) { return macros[index]; }
+void WriteByte (unsigned char add, unsigned char data) {}
+void WriteWord (unsigned char add, unsigned int data) {}
+unsigned int ReadWord (unsigned char add) { return 0; }
+unsigned char Sched_GetCount (void) { return 5; }
+unsigned int Sched_GetWorst (unsigned char task) { return task; }
+unsigned int Sched_Overruns (void) { return 0; }
+void Sched_GetDuty (unsigned int *busy, unsigned int *awake) { *busy = 1; *awake = 2; }
+
+#include "../SBUS.c"
+
+static void Feed (const unsigned char data[], size_t size) {
+	size_t i;
+
+	for (i=0; i<size; i++) RS485_RxBuf[RS485_WtPtr++] = data[i];
+}
+
+static unsigned int replies;			// calls that started a reply
+static unsigned long worstCall;			// longest call in uS
+
+static void Call (void) {
+	// A tick passes and then SBUS_Process_Command() runs -- it never takes a tick
+	unsigned long start = micros;
+	unsigned int sent = txSize;
+
+	Send(TICK);
+	SBUS_Process_Command();
+	Check(micros - start < TICK, "call within a tick", micros - start);
+	if (micros - start > worstCall) worstCall = micros - start;
+	if ((sent == 0) && (txSize > 0)) replies++;
+}
+
+static void Idle (unsigned int calls) {
+	// Runs 'calls' calls then lets any reply finish and the driver turn back around
+	unsigned int i;
+
+	for (i=0; i<calls; i++) Call();
+	for (i=0; (i<SETTLE) && !(RS485_Idle() && (replyCommand == 0)); i++) Call();
+	Check(RS485_Idle() && (replyCommand == 0), "reply finished", txSize);
+}
+
+static unsigned int ReplyData (BOOL bin, unsigned char data[]) {
+	// Gets the data bytes of the reply
+	static Frame frame;
+	unsigned int i;
+
+	if (bin) {
+		if (Decode(txBuf, txSize, &frame) != (long)txSize) return 0;
+		memcpy(data, frame.data, frame.length);
+		return frame.length;
+	}
+	if (txSize < 13) return 0;		// ':', the header, and "00" CR LF
+	for (i=0; i<(txSize-13)/2; i++) data[i] = (fromHex(txBuf[9+2*i]) << 4) | fromHex(txBuf[10+2*i]);
+	return i;
+}
+
+static size_t MakeFrame (const char *hex, BOOL bin, unsigned char out[]) {
+	// Makes an ASCII or binary frame from the digits in 'hex'
+	static Frame frame;
+
+	if (bin) {
+		FromHex(hex, &frame);
+		return Encode(&frame, 1 + rand() % 8, out);
+	}
+	return sprintf((char *)out, ":%s00\r\n", hex);
+}
+
+static BOOL GoodReply (BOOL bin, unsigned char command) {
+	// TRUE if the reply is a single well formed frame for 'command'
+	static Frame frame;
+
+	if (bin) return (Decode(txBuf, txSize, &frame) == (long)txSize) && (frame.device == DEVICE) && (frame.command == command);
+	return (txSize > 11) && (txBuf[0] == ':') && (txBuf[txSize-2] == CR) && (txBuf[txSize-1] == LF) &&
+		   (fromHex(txBuf[3]) == (command >> 4)) && (fromHex(txBuf[4]) == (command & 0x0F));
+}
+
+static int Test (void) {
+	static unsigned char frame[512], data[2048], expect[2048];
+	static const char *noise[] = {":0590AB", "\x02\x05\x90", "zz\r\n", ":", "\x02", "05900000"};
+	char hex[64];
+	unsigned int n, kind, before, macro, count, length, i;
+	size_t size, pos, piece;
+	BOOL bin, other;
+	unsigned char b;
+
+	hostEEPROM[DEVICEADD] = DEVICE;
+	SBUS_Init();
+
+	// enable binary frames
+	size = MakeFrame("055001020001", FALSE, frame);
+	Feed(frame, size); txSize = 0; Idle(3);
+	Check(GoodReply(FALSE, CONFIGURE) && binaryMode, "binary mode", 0);
+
+	srand(1);
+	for (n=0; n<FRAMES; n++) {
+		// a random frame in ASCII or binary, sometimes after noise or a truncated frame
+		bin = rand() & 1;
+		kind = rand() % 6;
+		other = (rand() % 8) == 0;
+		b = rand();
+		macro = rand() & 0xFFFF;
+		count = 1 + rand() % 60;
+		switch (kind) {
+			case 0: sprintf(hex, "%02X90%02X3A%02X0A02", other ? DEVICE+1 : DEVICE, b, b ^ 0x55); break;
+			case 1: sprintf(hex, "%02X20FFFF%02X%02X%02X%02X%02X%02X", other ? DEVICE+1 : DEVICE, b, 1, 2, 3, 4, 5); break;
+			case 2: sprintf(hex, "%02X800000%04X", other ? DEVICE+1 : DEVICE, macro); break;
+			case 3: sprintf(hex, "%02X100000%04X", other ? DEVICE+1 : DEVICE, count); break;	// long replies
+			case 4: sprintf(hex, "%02X70FFFF", other ? DEVICE+1 : DEVICE); break;
+			default: sprintf(hex, "%02X60FFFF", other ? DEVICE+1 : DEVICE); break;
+		}
+		if (rand() % 4 == 0) {
+			const char *s = noise[rand() % (sizeof(noise)/sizeof(noise[0]))];
+			Feed((const unsigned char *)s, rand() % (strlen(s) + 1));
+			Idle((s[0] == STX) ? TIMEOUT+2 : 3);	// the host waits out an abandoned binary frame
+		}
+		size = MakeFrame(hex, bin, frame);
+		before = displays; segments = 0; txSize = 0; replies = 0;
+		macroCount = (kind == 4) ? count : 0;
+		for (i=0; i<macroCount; i++) macros[i] = macro + i;
+
+		// feed the frame in random pieces -- sometimes nothing at all arrives between calls
+		for (pos=0; pos<size; pos+=piece) {
+			piece = (rand() % 3 == 0) ? 0 : 1 + rand() % (size - pos);
+			Feed(&frame[pos], piece);
+			Call();
+		}
+		Idle(3);
+
+		if (other) {
+			Check((replies == 0) && (displays == before) && (segments == 0) && (macroCount == ((kind == 4) ? count : 0)), "other device ignored", n);
+			continue;
+		}
+		Check(replies == 1, "one reply per frame", n);
+		switch (kind) {
+			case 0:
+				Check((displays == before+1) && (outputs[0] == b) && (outputs[1] == 0x3A) &&
+					  (outputs[2] == (b ^ 0x55)) && (outputs[3] == 0x0A), "display", n);
+				Check(GoodReply(bin, DISPLAY), "display reply", n); break;
+			case 1: Check((segments == 1) && GoodReply(bin, WRITESEGS), "write segments", n); break;
+			case 2: Check((macroCount == 1) && (macros[0] == macro) && GoodReply(bin, WRITEMACROS), "write macros", n); break;
+			case 3:
+				// the count then the size and data of each sequence
+				expect[0] = count >> 8; expect[1] = count; length = 2;
+				for (i=0; i<count; i++) {
+					expect[length++] = BYTESPERSEQ;
+					memset(&expect[length], i, BYTESPERSEQ);
+					length += BYTESPERSEQ;
+				}
+				Check(GoodReply(bin, READSEGS) && (ReplyData(bin, data) == length) && (memcmp(data, expect, length) == 0), "read segments", n);
+				break;
+			case 4:
+				expect[0] = count >> 8; expect[1] = count; length = 2;
+				for (i=0; i<count; i++) { expect[length++] = (macro + i) >> 8; expect[length++] = macro + i; }
+				Check(GoodReply(bin, READMACROS) && (ReplyData(bin, data) == length) && (memcmp(data, expect, length) == 0), "read macros", n);
+				break;
+			default: Check(GoodReply(bin, REPORT), "report", n); break;
+		}
+	}
+
+	// damaged frames get no reply and change nothing
+	size = MakeFrame("0590112233440A", TRUE, frame);
+	frame[size-1] ^= 1;
+	before = displays; txSize = 0;
+	Feed(frame, size); Idle(TIMEOUT+2);
+	Check((displays == before) && (txSize == 0), "bad CRC", 0);
+	Feed((const unsigned char *)":0590112G33440A00\r\n", 19); Idle(3);
+	Check((displays == before) && (txSize == 0), "bad digit", 0);
+
+	// a frame without its length word is an error
+	size = MakeFrame("05901122", FALSE, frame);
+	txSize = 0; Feed(frame, size); Idle(3);
+	Check((displays == before) && (txSize > 15) && (memcmp(&txBuf[9], "EF90", 4) == 0), "missing length", txSize);
+
+	// one channel ramps on its own and a bad channel is an error
+	size = MakeFrame("05A00002801E05", FALSE, frame);
+	txSize = 0; override = FALSE; Feed(frame, size); Idle(3);
+	Check(GoodReply(FALSE, RAMP) && override && (ramp[0] == 2) && (ramp[1] == 0x80) && (ramp[2] == 0x1E) && (ramp[3] == 5), "ramp", 0);
+	size = MakeFrame("05A00004801E05", FALSE, frame);
+	txSize = 0; Feed(frame, size); Idle(3);
+	Check((txSize > 15) && (memcmp(&txBuf[9], "EFA0", 4) == 0), "ramp channel", txSize);
+
+	// the ramp queue report
+	size = MakeFrame("05600104", FALSE, frame);
+	txSize = 0; Feed(frame, size); Idle(3);
+	Check(GoodReply(FALSE, REPORT) && (memcmp(&txBuf[9], "020007", 6) == 0), "queue report", txSize);
+
+	printf("longest call %luuS waiting for the port, %uuS tick\n", worstCall, (unsigned)TICK);
+	printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+	if ((argc == 2) && (strcmp(argv[1], "test") == 0)) return Test();
+	fprintf(stderr, "usage: %s test\n", argv[0]);
+	return 2;
+}
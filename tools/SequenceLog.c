@@ -0,0 +1,337 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	SequenceLog.c
+* \details  Host test of the sequence directory and log in \em Sequences.c.  Random
+*			sequence adds, appends, deletes, and compaction steps are made against
+*			a simulated 24xx256 and a plain copy of what the sequences should
+*			hold.  After every operation the directory must give back exactly
+*			that copy through Seq_Count(), Seq_CopyToBuffer(), and the segment
+*			walk used for playback, and so must a directory rebuilt from the log.
+*
+*			The EEPROM is then filled to check that a sequence is only refused
+*			when it doesn't fit, and power is cut part way through operations
+*			on the full EEPROM.  The simulated EEPROM writes a page at a time,
+*			as the real one does, and stops after a random number of page
+*			writes.  The controller is restarted and the sequences must then be
+*			what they were either before or after the interrupted operation.
+*
+*			Last, logs written by the original firmware, without extent headers,
+*			are converted by Seq_Init().  Most are short so the power cuts, at
+*			any page write of the conversion, often land near its end.  Every
+*			sequence that still fits below the directory must come through.
+*
+*			Build and run on the host:
+*				cc -I. -o SequenceLog SequenceLog.c
+*				./SequenceLog test
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "../Types.h"
+#include "../EEPROM.h"
+#include "../Clock.h"
+
+#define OPERATIONS	20000				// random operations checked
+#define POWERCUTS	3000				// operations interrupted by a power cut
+#define MIGRATIONS	2000				// original logs converted
+#define MAXSEQS		120					// sequences kept in the test
+#define MAXSEGS		80					// segments in a sequence
+#define ROMSIZE		(1024*32)			// 24xx256
+#define ROMPAGE		64					// write page
+
+// Simulated EEPROM -- power is cut before the page write that uses up 'budget'
+static unsigned char rom[ROMSIZE];
+static unsigned int readAdd;
+static long budget = -1;				// page writes until the power cut (-1 never)
+static long pageWrites;					// page writes made
+static jmp_buf powerCut;
+
+void EEPROM_Init (void) {}
+BOOL EEPROM_Present (void) { return TRUE; }
+unsigned int EEPROM_GetSize (void) { return ROMSIZE; }
+void EEPROM_OpenRead (unsigned int add) { readAdd = add; }
+unsigned char EEPROM_ReadNext (void) { return rom[readAdd++ % ROMSIZE]; }
+void EEPROM_ReadBlock (unsigned char buffer[], unsigned int size) { while (size-- > 0) *buffer++ = EEPROM_ReadNext(); }
+void EEPROM_CloseRead (void) {}
+unsigned char EEPROM_ReadChar (unsigned int add) { return rom[add % ROMSIZE]; }
+void EEPROM_Read (unsigned int add, unsigned char buffer[], unsigned int size) { EEPROM_OpenRead(add); EEPROM_ReadBlock(buffer, size); }
+
+void EEPROM_Write (unsigned int add, unsigned char buffer[], unsigned int size) {
+	unsigned int part;
+
+	while (size > 0) {
+		part = ROMPAGE - (add % ROMPAGE);
+		if (part > size) part = size;
+		if (budget == 0) longjmp(powerCut, 1);
+		if (budget > 0) budget--;
+		pageWrites++;
+		memcpy(&rom[add % ROMSIZE], buffer, part);
+		add += part; buffer += part; size -= part;
+	}
+}
+
+void EEPROM_WriteChar (unsigned int add, unsigned char ch) { EEPROM_Write(add, &ch, 1); }
+
+#include "../Sequences.c"
+
+// What the sequences should hold
+typedef struct _Model {
+	unsigned int count;
+	unsigned int segs[MAXSEQS];
+	unsigned char data[MAXSEQS][MAXSEGS*BYTESPERSEQ];
+} Model;
+
+static Model model, before;
+static unsigned char original[ROMSIZE];
+
+static int failures;
+
+static void Check (int ok, const char *test, unsigned int detail) {
+	if (!ok) {
+		failures++;
+		if (failures < 20) printf("FAIL: %s (%u)\n", test, detail);
+	}
+}
+
+static BOOL Same (const Model *m) {
+	// TRUE if the directory gives back the sequences in 'm'
+	static unsigned char buffer[MAXSEGS*BYTESPERSEQ+1];
+	const Segment *segment;
+	unsigned int seq, i;
+
+	if (Seq_Count() != m->count) return FALSE;
+	for (seq=0; seq<m->count; seq++) {
+		if (Seq_CopyToBuffer(seq, buffer) != m->segs[seq]*BYTESPERSEQ) return FALSE;
+		if (memcmp(buffer, m->data[seq], m->segs[seq]*BYTESPERSEQ) != 0) return FALSE;
+	}
+	if (m->count > 0) {
+		// playback walks the segments with the look-ahead byte
+		seq = rand() % m->count;
+		Seq_Find(seq);
+		for (i=0; i<m->segs[seq]; i++) {
+			segment = Seq_GetSegment();
+			if (memcmp(segment, &m->data[seq][i*BYTESPERSEQ], BYTESPERSEQ) != 0) return FALSE;
+			if ((segment->next == ENDMARK) != (i+1 == m->segs[seq])) return FALSE;
+			Seq_Next(REPEAT);
+		}
+	}
+	return TRUE;
+}
+
+static BOOL Extend (Model *m, unsigned int seq) {
+	// Adds a segment to sequence 'seq' or makes it if it doesn't exist yet
+	unsigned char segs[BYTESPERSEQ];
+	unsigned int i;
+
+	for (i=0; i<BYTESPERSEQ; i++) segs[i] = rand() % 255;
+	if (seq >= m->count) {
+		if (m->count >= MAXSEQS) return TRUE;
+		seq = m->count++;
+		m->segs[seq] = 0;
+	}
+	if (m->segs[seq] >= MAXSEGS) return TRUE;
+	memcpy(&m->data[seq][m->segs[seq]*BYTESPERSEQ], segs, BYTESPERSEQ);
+	m->segs[seq]++;
+	if (((m->segs[seq] == 1) && Seq_New_Multi(segs, 1)) || ((m->segs[seq] > 1) && Seq_AddToMulti(seq, segs, 1))) return TRUE;
+	if (--m->segs[seq] == 0) m->count--;
+	return FALSE;
+}
+
+static BOOL Operate (Model *m) {
+	// Makes a random change to the sequences and to 'm'.  'm' is changed first so it
+	// holds the result even if the power is cut.  Returns FALSE if the change was 
+	// refused, which is only allowed when the EEPROM is full.
+	static unsigned char segs[MAXSEGS*BYTESPERSEQ];
+	unsigned int seq, last, blocks, i;
+
+	blocks = 1 + rand() % ((rand() % 4) ? 12 : MAXSEGS/2);
+	for (i=0; i<blocks*BYTESPERSEQ; i++) segs[i] = rand() % 255;	// never an ENDMARK
+	switch (rand() % 10) {
+		case 0: case 1: case 2: case 3:
+			// new sequence
+			if (m->count >= MAXSEQS) return TRUE;
+			m->segs[m->count] = blocks;
+			memcpy(m->data[m->count], segs, blocks*BYTESPERSEQ);
+			m->count++;
+			if (Seq_New_Multi(segs, blocks)) return TRUE;
+			m->count--;
+			return FALSE;
+		case 4: case 5: case 6:
+			// extend a sequence
+			if (m->count == 0) return TRUE;
+			seq = rand() % m->count;
+			if (m->segs[seq]+blocks > MAXSEGS) return TRUE;
+			memcpy(&m->data[seq][m->segs[seq]*BYTESPERSEQ], segs, blocks*BYTESPERSEQ);
+			m->segs[seq] += blocks;
+			if (Seq_AddToMulti(seq, segs, blocks)) return TRUE;
+			m->segs[seq] -= blocks;
+			return FALSE;
+		case 7:
+			// delete a range
+			if (m->count == 0) return TRUE;
+			seq = rand() % m->count;
+			last = seq + rand() % 3;
+			if (last >= m->count) last = m->count-1;
+			for (i=last+1; i<m->count; i++) {
+				m->segs[i-(last-seq+1)] = m->segs[i];
+				memcpy(m->data[i-(last-seq+1)], m->data[i], sizeof(m->data[i]));
+			}
+			m->count -= last-seq+1;
+			Check(Seq_Delete_Range(seq, last), "delete", seq);
+			return TRUE;
+		case 8:
+			if (rand() % 50 == 0) {
+				m->count = 0;
+				Seq_DeleteAll();
+			}
+			return TRUE;
+		default:
+			for (i=rand() % 20; i>0; i--) Seq_Compact();
+			return TRUE;
+	}
+}
+
+static unsigned int Used (const Model *m) {
+	// Log bytes used by the sequences in 'm'
+	unsigned int seq, bytes = 1;
+
+	for (seq=0; seq<m->count; seq++) bytes += m->segs[seq]*BYTESPERSEQ+EXTHEADER+1;
+	return bytes;
+}
+
+static void Restart (void) {
+	// Restarts the controller after a power cut -- which may happen again while the
+	// directory is rebuilt
+	budget = -1;
+	while (setjmp(powerCut)) budget = -1;
+	budget = rand() % 4 ? -1 : rand() % 20;
+	Seq_Init();
+	budget = -1;
+}
+
+static void Original (Model *m, unsigned int seqs) {
+	// Writes up to 'seqs' random sequences in the original log format and keeps those
+	// that will still fit below the directory with their extent headers in 'm'
+	unsigned int add = 0, seq, segs, i;
+
+	memset(rom, 0xFF, sizeof(rom));
+	m->count = 0;
+	for (seq=0; seq<seqs; seq++) {
+		segs = 1 + rand() % MAXSEGS;
+		if (add+segs*BYTESPERSEQ+2 >= ROMSIZE-2) break;
+		for (i=0; i<segs*BYTESPERSEQ; i++) rom[add+i] = rand() % 255;
+		rom[add+segs*BYTESPERSEQ] = ENDMARK;
+		if (add+segs*BYTESPERSEQ+1+(seq+1)*EXTHEADER < ROMSIZE-DIRSIZE) {
+			m->segs[seq] = segs;
+			memcpy(m->data[seq], &rom[add], segs*BYTESPERSEQ);
+			m->count = seq+1;
+		}
+		add += segs*BYTESPERSEQ+1;
+	}
+	rom[add] = ENDMARK;
+	rom[ROMSIZE-2] = OLDMAGIC[0]; rom[ROMSIZE-1] = OLDMAGIC[1];
+}
+
+static int Test (void) {
+	unsigned int n, cuts = 0, refused = 0, converted = 0;
+	BOOL ok;
+
+	srand(1);
+	memset(rom, 0xFF, sizeof(rom));
+	Seq_Init();
+	Check(Seq_Count() == 0, "empty", 0);
+
+	for (n=0; n<OPERATIONS; n++) {
+		ok = Operate(&model);
+		if (!ok) {
+			refused++;
+			Check(Used(&model) + 2*MAXSEGS*BYTESPERSEQ + EXTHEADER > ROMSIZE - DIRSIZE, "refused with room", Used(&model));
+		}
+		Check(Same(&model), "directory", n);
+
+		// the directory survives a restart and a rebuild from the log
+		if (n % 97 == 0) {
+			Seq_Init();
+			Check(Same(&model), "restart", n);
+			Seq_RebuildIndex();
+			Check(Same(&model), "rebuild", n);
+		}
+	}
+
+	// fill the EEPROM -- compaction has to make room for most of these
+	for (n=0; refused<10; n++) {
+		if (!Extend(&model, n % MAXSEQS)) {
+			refused++;
+			Check(Used(&model) + (MAXSEGS+1)*BYTESPERSEQ + EXTHEADER > ROMSIZE - DIRSIZE, "refused with room", Used(&model));
+		}
+		Check(Same(&model), "fill", n);
+	}
+
+	// power cuts part way through operations
+	for (n=0; n<POWERCUTS; n++) {
+		memcpy(&before, &model, sizeof(model));
+		budget = rand() % 40;
+		if (setjmp(powerCut) == 0) {
+			Operate(&model);
+			budget = -1;
+			Seq_Init();
+			Check(Same(&model), "finished", n);
+		} else {
+			cuts++;
+			Restart();
+			if (Same(&before)) memcpy(&model, &before, sizeof(model));
+			else Check(Same(&model), "power cut", n);
+		}
+		Seq_Init();
+		Check(Same(&model), "after power cut", n);
+	}
+
+	// conversion of the original log format
+	for (n=0; n<MIGRATIONS; n++) {
+		Original(&model, (rand() % 4) ? rand() % 8 : MAXSEQS);
+		converted += model.count;
+		if (n % 2) {
+			// cut the power at any page write of the conversion
+			memcpy(original, rom, sizeof(rom));
+			pageWrites = 0;
+			Seq_Init();
+			memcpy(rom, original, sizeof(rom));
+			budget = rand() % pageWrites;
+		}
+		if (setjmp(powerCut) == 0) {
+			Seq_Init();
+			budget = -1;
+		} else {
+			cuts++;
+			Restart();
+		}
+		Check(Same(&model), "converted", n);
+		Seq_Init();
+		Seq_RebuildIndex();
+		Check(Same(&model), "converted and rebuilt", n);
+		while (Operate(&model)) if (rand() % 4 == 0) break;
+		Check(Same(&model), "in use after conversion", n);
+	}
+
+	printf("%u operations (%u refused with the EEPROM full), %u power cuts, %u sequences left\n",
+		   OPERATIONS, refused, cuts, model.count);
+	printf("%u original logs converted with %u sequences\n", MIGRATIONS, converted);
+	printf("%s: %d failures\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
+
+int main (int argc, char *argv[]) {
+	if ((argc == 2) && (strcmp(argv[1], "test") == 0)) return Test();
+	fprintf(stderr, "usage: %s test\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,143 @@
+//************************************************************************************
+//
+// This source is Copyright (c) 2026 by Computer Inspirations.  All rights reserved.
+// You are permitted to modify and use this code for personal use only.
+//
+//************************************************************************************
+/**
+* \file   	xc.h
+* \details  Host stand-in for the XC8 compiler header so the host test programs
+*			in this directory can include the firmware sources.  The special
+*			function registers used by the firmware are plain variables that
+*			a test sets and inspects, the delay and interrupt control macros do
+*			nothing, and the internal data EEPROM is a RAM array.  Each test is
+*			a single source file so the registers are defined here.
+*
+*			A test that defines MSSP_MODEL before including the firmware
+*			supplies MSSP_Access() instead.  Every access to the MSSP1 buffer,
+*			status, and control registers then runs the test's bus model so
+*			the registers change as the hardware would change them.
+*
+*			A test that defines PWM_MODEL supplies PWM_Access() and PWM_Timer4()
+*			the same way.  Every access to TMR2 or to a CCP duty cycle register
+*			runs the test's Timer2 model, and every read of TMR4 lets it charge
+*			the time the tick has taken.
+*
+*			Build a test from this directory so this header is found first:
+*				cc -I. -o SBUSSplit SBUSSplit.c
+* \author   agent
+* \date   	17 Oct 2026
+*/
+//************************************************************************************
+
+#ifndef _HOST_XC_H_
+#define _HOST_XC_H_
+
+#define interrupt
+#define __delay_ms(x)	((void)0)
+#define __delay_us(x)	((void)0)
+#define di()			((void)0)
+#define ei()			((void)0)
+#define SLEEP()			((void)0)
+#define NOP()			((void)0)
+#define CLRWDT()		((void)0)
+#define __EEPROM_DATA(a,b,c,d,e,f,g,h)
+
+// Internal data EEPROM
+volatile unsigned char hostEEPROM[256];
+#define eeprom_read(add)		(hostEEPROM[(unsigned char)(add)])
+#define eeprom_write(add, val)	(hostEEPROM[(unsigned char)(add)] = (val))
+
+// Interrupt enables and flags
+volatile unsigned char GIE, PEIE, TMR2IE, TMR2IF, TMR4IE, TMR4IF, TMR6IE, TMR6IF;
+volatile unsigned char RCIE, RCIF, TXIE, TXIF, IOCIE, IOCAF;
+typedef struct { unsigned TMR2IF:1; unsigned SSP1IF:1; } PIR1_t;
+volatile struct { unsigned BCL1IF:1; } PIR2bits;
+volatile struct { unsigned TMR4IF:1; unsigned TMR6IF:1; } PIR3bits;
+
+// Clock, watchdog, and sleep
+volatile struct { unsigned SCS:2; unsigned IRCF:4; unsigned SPLLEN:1; } OSCCONbits;
+volatile struct { unsigned PLLR:1; } OSCSTATbits;
+volatile struct { unsigned SWDTEN:1; unsigned WDTPS:5; } WDTCONbits;
+volatile struct { unsigned nTO:1; unsigned nPD:1; } STATUSbits;
+
+// Timers and CCP modules
+volatile unsigned char PR2, PR4, TMR6, PR6;
+volatile struct { unsigned T2CKPS:2; unsigned TMR2ON:1; } T2CONbits;
+volatile struct { unsigned T4CKPS:2; unsigned TMR4ON:1; } T4CONbits;
+volatile struct { unsigned C1TSEL:2; unsigned C2TSEL:2; unsigned C3TSEL:2; unsigned C4TSEL:2; } CCPTMRSbits;
+typedef struct { unsigned CCP1M:4; unsigned DC1B:2; } CCP1CON_t;
+typedef struct { unsigned CCP2M:4; unsigned DC2B:2; } CCP2CON_t;
+typedef struct { unsigned CCP3M:4; unsigned DC3B:2; } CCP3CON_t;
+typedef struct { unsigned CCP4M:4; unsigned DC4B:2; } CCP4CON_t;
+#ifdef PWM_MODEL
+// TMR2 and the duty cycle registers together so the model sees every access
+typedef struct { unsigned char tmr2, ccpr1l, ccpr2l, ccpr3l, ccpr4l;
+				 CCP1CON_t ccp1con; CCP2CON_t ccp2con; CCP3CON_t ccp3con; CCP4CON_t ccp4con; } PWM_t;
+extern volatile PWM_t *PWM_Access (void);
+extern volatile unsigned char *PWM_Timer4 (void);
+#define TMR2			(PWM_Access()->tmr2)
+#define CCPR1L			(PWM_Access()->ccpr1l)
+#define CCPR2L			(PWM_Access()->ccpr2l)
+#define CCPR3L			(PWM_Access()->ccpr3l)
+#define CCPR4L			(PWM_Access()->ccpr4l)
+#define CCP1CONbits		(PWM_Access()->ccp1con)
+#define CCP2CONbits		(PWM_Access()->ccp2con)
+#define CCP3CONbits		(PWM_Access()->ccp3con)
+#define CCP4CONbits		(PWM_Access()->ccp4con)
+#define TMR4			(*PWM_Timer4())
+#else
+volatile unsigned char TMR2, TMR4;
+volatile unsigned char CCPR1L, CCPR2L, CCPR3L, CCPR4L;
+volatile CCP1CON_t CCP1CONbits;
+volatile CCP2CON_t CCP2CONbits;
+volatile CCP3CON_t CCP3CONbits;
+volatile CCP4CON_t CCP4CONbits;
+#endif
+
+// UART
+volatile unsigned char RCREG, TXREG, SPBRG, RCSTA, TXSTA;
+volatile struct { unsigned TRMT:1; } TXSTAbits;
+volatile struct { unsigned WUE:1; unsigned RCIDL:1; } BAUDCONbits;
+
+// MSSP1
+typedef union { unsigned char reg; struct { unsigned BF:1; unsigned :1; unsigned R_nW:1; }; } SSP1STAT_t;
+typedef union { unsigned char reg; struct { unsigned SEN:1; unsigned RSEN:1; unsigned PEN:1; unsigned RCEN:1;
+						unsigned ACKEN:1; unsigned ACKDT:1; unsigned ACKSTAT:1; unsigned GCEN:1; }; } SSP1CON2_t;
+volatile unsigned char SSP1ADD, SSP1CON1, SSP1CON3;
+#ifdef MSSP_MODEL
+// SSP1BUF is wider than a byte so the model can tell a write from a read
+typedef struct { unsigned int buf; SSP1STAT_t stat; SSP1CON2_t con2; PIR1_t pir1; } MSSP_t;
+extern volatile MSSP_t *MSSP_Access (void);
+#define SSP1BUF			(MSSP_Access()->buf)
+#define SSP1STATbits	(MSSP_Access()->stat)
+#define SSP1CON2bits	(MSSP_Access()->con2)
+#define PIR1bits		(MSSP_Access()->pir1)
+#else
+volatile unsigned char SSP1BUF;
+volatile SSP1STAT_t SSP1STATbits;
+volatile SSP1CON2_t SSP1CON2bits;
+volatile PIR1_t PIR1bits;
+#endif
+#define SSP1STAT	(SSP1STATbits.reg)
+#define SSP1CON2	(SSP1CON2bits.reg)
+
+// I/O ports
+volatile unsigned char ANSELA, ANSELB, ANSELC, APFCON1, FVRCON;
+volatile struct { unsigned TRISA0:1; unsigned TRISA1:1; unsigned TRISA2:1; unsigned TRISA4:1; unsigned TRISA5:1; } TRISAbits;
+volatile struct { unsigned TRISB4:1; unsigned TRISB5:1; unsigned TRISB6:1; unsigned TRISB7:1; } TRISBbits;
+volatile struct { unsigned TRISC0:1; unsigned TRISC2:1; unsigned TRISC4:1; unsigned TRISC5:1; unsigned TRISC6:1; } TRISCbits;
+volatile struct { unsigned RA0:1; unsigned RA4:1; } PORTAbits;
+volatile struct { unsigned RB4:1; } PORTBbits;
+volatile struct { unsigned RC2:1; } PORTCbits;
+volatile struct { unsigned LATB4:1; unsigned LATB6:1; } LATBbits;
+volatile struct { unsigned LATC0:1; unsigned LATC4:1; } LATCbits;
+volatile struct { unsigned WPUA0:1; unsigned WPUA1:1; } WPUAbits;
+volatile struct { unsigned WPUB5:1; } WPUBbits;
+volatile struct { unsigned WPUC2:1; } WPUCbits;
+volatile struct { unsigned IOCAN0:1; } IOCANbits;
+volatile struct { unsigned nWPUEN:1; } OPTION_REGbits;
+#define TRISB5		(TRISBbits.TRISB5)
+#define TRISB7		(TRISBbits.TRISB7)
+
+#endif